@@ -0,0 +1,735 @@
+/*
+ * Benchmarks of the libgd scaling and rotation functions.
+ *
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "gd-resize.h"
+#include "gd-rotate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/*
+ * Runs every scaler over a matrix of sizes, ratios and pixel formats and
+ * writes the results as a JSON document, one object per case :
+ *
+ *   api            gd_img_scale, gd_pixbuf_scale, gdk_pixbuf_scale,
+ *                  gd_pixbuf_rotate, gd_pixbuf_rotate_in_place or
+ *                  gdk_pixbuf_rotate
+ *   method         gd_interpolation_method_get_name(), the GdkInterpType
+ *                  or rotate-90, rotate-180, flip-h, flip-v
+ *   format         rgb, rgba or packed (gdImage, four bytes per pixel)
+ *   src, dst       sizes in pixels
+ *   ms             best time of the runs
+ *   src_mps        source megapixels per second
+ *   dst_mps        destination megapixels per second
+ *   gbps           bytes read and written once per second, to compare
+ *                  with memcpy_gbps at the top of the document
+ *   rss_kb         resident memory before the case
+ *   peak_rss_kb    peak resident memory during the case, or since the
+ *                  start when the kernel can't reset the peak
+ *   allocs         number of malloc/calloc/realloc/posix_memalign calls
+ *                  made by libgd, null when they aren't counted
+ *   alloc_bytes    bytes requested by these calls
+ *
+ * Cases that a scaler doesn't support are written with "ok": false.
+ */
+
+#define BENCH_RUNS 5
+#define BENCH_MIN_TIME 1.0 // seconds, stops the runs once reached
+
+static const char *_bench_default_sizes = "1152x864,4000x3000,10000x10000";
+static const gdouble _bench_ratios[] = {0.25, 0.5, 2.0};
+
+// allocations -----------------------------------------------------------------
+
+/*
+ * With BENCH_COUNT_ALLOCS the executable is linked with --wrap for the
+ * allocation functions, every call made by the objects linked in, that's
+ * libgd, goes through the wrappers below. GLib and GdkPixbuf allocations
+ * are in shared libraries and aren't counted.
+ */
+#ifdef BENCH_COUNT_ALLOCS
+
+static gint _bench_allocs;
+static gsize _bench_alloc_bytes;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+void* __real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+static void _bench_count_alloc(size_t size)
+{
+    g_atomic_int_inc(&_bench_allocs);
+    g_atomic_pointer_add(&_bench_alloc_bytes, size);
+}
+
+void* __wrap_malloc(size_t size)
+{
+    _bench_count_alloc(size);
+
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    _bench_count_alloc(nmemb * size);
+
+    return __real_calloc(nmemb, size);
+}
+
+void* __wrap_realloc(void *ptr, size_t size)
+{
+    _bench_count_alloc(size);
+
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    _bench_count_alloc(size);
+
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+static void _bench_allocs_reset()
+{
+    g_atomic_int_set(&_bench_allocs, 0);
+    g_atomic_pointer_set(&_bench_alloc_bytes, 0);
+}
+
+#endif
+
+// resident memory -------------------------------------------------------------
+
+// resets VmHWM of /proc/self/status, Linux 4.0 and later
+static void _bench_rss_reset_peak()
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (!fp)
+        return;
+
+    fputs("5", fp);
+    fclose(fp);
+}
+
+static glong _bench_rss_get(const char *key)
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if (!fp)
+    {
+        // only the peak of the whole process is available
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        return usage.ru_maxrss;
+    }
+
+    const size_t len = strlen(key);
+    char line[256];
+    glong value = -1;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (strncmp(line, key, len) == 0 && line[len] == ':')
+        {
+            value = atol(line + len + 1);
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return value;
+}
+
+// images ----------------------------------------------------------------------
+
+static void _bench_fill(guchar *pixels, gsize size)
+{
+    guint32 seed = 1;
+
+    for (gsize i = 0; i < size; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        pixels[i] = seed >> 24;
+    }
+}
+
+static GdkPixbuf* _bench_pixbuf_new(int width, int height, gboolean alpha)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8,
+                                       width, height);
+    if (!pixbuf)
+        return NULL;
+
+    _bench_fill(gdk_pixbuf_get_pixels(pixbuf),
+                (gsize) height * gdk_pixbuf_get_rowstride(pixbuf));
+
+    return pixbuf;
+}
+
+static gdImage* _bench_img_new(int width, int height)
+{
+    gdImage *img = gd_img_new(width, height);
+    if (!img)
+        return NULL;
+
+    _bench_fill((guchar*) img->pixels,
+                (gsize) height * img->stride * sizeof(uint32_t));
+
+    img->has_alpha = true;
+
+    return img;
+}
+
+// best of BENCH_RUNS, in seconds
+static gdouble _bench_memcpy(gsize size)
+{
+    guchar *src = g_malloc(size);
+    guchar *dst = g_malloc(size);
+    gdouble best = G_MAXDOUBLE;
+
+    memset(src, 1, size);
+    memset(dst, 2, size);
+
+    for (int i = 0; i < BENCH_RUNS; ++i)
+    {
+        gint64 start = g_get_monotonic_time();
+        memcpy(dst, src, size);
+        best = MIN(best, (g_get_monotonic_time() - start) / 1e6);
+    }
+
+    g_free(src);
+    g_free(dst);
+
+    return best;
+}
+
+// cases -----------------------------------------------------------------------
+
+typedef enum
+{
+    BENCH_GD_IMG,
+    BENCH_GD_PIXBUF,
+    BENCH_GDK_PIXBUF,
+    BENCH_GD_ROTATE,
+    BENCH_GD_ROTATE_IN_PLACE,
+    BENCH_GDK_ROTATE,
+
+} BenchApi;
+
+typedef struct _BenchCase BenchCase;
+
+struct _BenchCase
+{
+    BenchApi api;
+    const char *method_name;
+    gdInterpolationMethod method;
+    GdkInterpType interp;
+    GdkPixbufRotation angle;
+    gboolean flip;
+
+    // one of them is set depending on api
+    GdkPixbuf *pixbuf;
+    gdImage *img;
+
+    int dst_width;
+    int dst_height;
+};
+
+// runs the case once, returns the time in seconds or -1 on failure
+static gdouble _bench_case_run(BenchCase *bc)
+{
+    gint64 start = g_get_monotonic_time();
+    gdouble elapsed = -1;
+
+    switch (bc->api)
+    {
+    case BENCH_GD_IMG:
+    {
+        gdImage *dst = gd_img_scale(bc->img, bc->dst_width, bc->dst_height);
+        elapsed = (g_get_monotonic_time() - start) / 1e6;
+
+        if (!dst)
+            return -1;
+
+        gd_img_free(dst);
+        break;
+    }
+
+    case BENCH_GD_PIXBUF:
+    {
+        GdkPixbuf *dst = gd_pixbuf_scale(bc->pixbuf,
+                                         bc->dst_width, bc->dst_height,
+                                         bc->method);
+        elapsed = (g_get_monotonic_time() - start) / 1e6;
+
+        if (!dst)
+            return -1;
+
+        g_object_unref(dst);
+        break;
+    }
+
+    case BENCH_GDK_PIXBUF:
+    {
+        GdkPixbuf *dst = gdk_pixbuf_scale_simple(bc->pixbuf,
+                                                 bc->dst_width,
+                                                 bc->dst_height,
+                                                 bc->interp);
+        elapsed = (g_get_monotonic_time() - start) / 1e6;
+
+        if (!dst)
+            return -1;
+
+        g_object_unref(dst);
+        break;
+    }
+
+    case BENCH_GD_ROTATE:
+    {
+        GdkPixbuf *dst = gd_pixbuf_rotate_flip(bc->pixbuf,
+                                               bc->angle, bc->flip);
+        elapsed = (g_get_monotonic_time() - start) / 1e6;
+
+        if (!dst)
+            return -1;
+
+        g_object_unref(dst);
+        break;
+    }
+
+    case BENCH_GD_ROTATE_IN_PLACE:
+    {
+        if (!gd_pixbuf_rotate_flip_in_place(bc->pixbuf, bc->angle, bc->flip))
+            return -1;
+
+        elapsed = (g_get_monotonic_time() - start) / 1e6;
+        break;
+    }
+
+    case BENCH_GDK_ROTATE:
+    {
+        // the flips are horizontal or vertical, without a rotation
+        GdkPixbuf *dst = bc->flip
+                            ? gdk_pixbuf_flip(bc->pixbuf,
+                                        bc->angle == GDK_PIXBUF_ROTATE_NONE)
+                            : gdk_pixbuf_rotate_simple(bc->pixbuf, bc->angle);
+        elapsed = (g_get_monotonic_time() - start) / 1e6;
+
+        if (!dst)
+            return -1;
+
+        g_object_unref(dst);
+        break;
+    }
+    }
+
+    return elapsed;
+}
+
+static void _bench_case(BenchCase *bc, FILE *fp, gboolean *first)
+{
+    static const char *api_names[] =
+    {
+        "gd_img_scale", "gd_pixbuf_scale", "gdk_pixbuf_scale",
+        "gd_pixbuf_rotate", "gd_pixbuf_rotate_in_place", "gdk_pixbuf_rotate"
+    };
+
+    int width, height, channels;
+    const char *format;
+
+    if (bc->img)
+    {
+        width = gd_img_sx(bc->img);
+        height = gd_img_sy(bc->img);
+        channels = 4;
+        format = "packed";
+    }
+    else
+    {
+        width = gdk_pixbuf_get_width(bc->pixbuf);
+        height = gdk_pixbuf_get_height(bc->pixbuf);
+        channels = gdk_pixbuf_get_n_channels(bc->pixbuf);
+        format = (channels == 4) ? "rgba" : "rgb";
+    }
+
+    const glong rss = _bench_rss_get("VmRSS");
+    _bench_rss_reset_peak();
+
+#ifdef BENCH_COUNT_ALLOCS
+    _bench_allocs_reset();
+#endif
+
+    // the first run is timed too, the following ones until BENCH_MIN_TIME
+    gdouble best = G_MAXDOUBLE;
+    gdouble total = 0;
+    int runs = 0;
+    gint allocs = 0;
+    gsize alloc_bytes = 0;
+
+    while (runs < BENCH_RUNS && total < BENCH_MIN_TIME)
+    {
+        gdouble elapsed = _bench_case_run(bc);
+
+        if (elapsed < 0)
+            break;
+
+        if (runs == 0)
+        {
+#ifdef BENCH_COUNT_ALLOCS
+            allocs = g_atomic_int_get(&_bench_allocs);
+            alloc_bytes = (gsize) g_atomic_pointer_get(&_bench_alloc_bytes);
+#endif
+        }
+
+        best = MIN(best, elapsed);
+        total += elapsed;
+        ++runs;
+    }
+
+    const glong peak = _bench_rss_get("VmHWM");
+
+    fprintf(fp, "%s\n    {\"api\": \"%s\", \"method\": \"%s\","
+                " \"format\": \"%s\","
+                " \"src\": [%d, %d], \"dst\": [%d, %d]",
+            *first ? "" : ",",
+            api_names[bc->api], bc->method_name, format,
+            width, height, bc->dst_width, bc->dst_height);
+
+    *first = FALSE;
+
+    if (runs == 0)
+    {
+        fprintf(fp, ", \"ok\": false}");
+        return;
+    }
+
+    const gdouble src_mp = (gdouble) width * height / 1e6;
+    const gdouble dst_mp = (gdouble) bc->dst_width * bc->dst_height / 1e6;
+    const gdouble bytes = (src_mp + dst_mp) * 1e6 * channels;
+
+    fprintf(fp, ", \"ok\": true, \"runs\": %d, \"ms\": %.3f,"
+                " \"src_mps\": %.2f, \"dst_mps\": %.2f, \"gbps\": %.3f,"
+                " \"rss_kb\": %ld, \"peak_rss_kb\": %ld",
+            runs, best * 1e3,
+            src_mp / best, dst_mp / best, bytes / best / 1e9,
+            rss, peak);
+
+    if (bc->api == BENCH_GDK_PIXBUF || bc->api == BENCH_GDK_ROTATE)
+    {
+        fprintf(fp, ", \"allocs\": null, \"alloc_bytes\": null}");
+        return;
+    }
+
+#ifdef BENCH_COUNT_ALLOCS
+    fprintf(fp, ", \"allocs\": %d, \"alloc_bytes\": %" G_GSIZE_FORMAT "}",
+            allocs, alloc_bytes);
+#else
+    (void) allocs;
+    (void) alloc_bytes;
+    fprintf(fp, ", \"allocs\": null, \"alloc_bytes\": null}");
+#endif
+}
+
+// matrix ----------------------------------------------------------------------
+
+static void _bench_size(int width, int height,
+                        const gboolean *methods, FILE *fp, gboolean *first)
+{
+    static const struct
+    {
+        const char *name;
+        GdkInterpType interp;
+    } gdk_interps[] =
+    {
+        {"nearest", GDK_INTERP_NEAREST},
+        {"bilinear", GDK_INTERP_BILINEAR},
+        {"hyper", GDK_INTERP_HYPER},
+    };
+
+    for (guint r = 0; r < G_N_ELEMENTS(_bench_ratios); ++r)
+    {
+        const int dst_width = (int) (width * _bench_ratios[r] + 0.5);
+        const int dst_height = (int) (height * _bench_ratios[r] + 0.5);
+
+        if (dst_width < 1 || dst_height < 1
+            || dst_width > VNR_MAX_SIZE || dst_height > VNR_MAX_SIZE)
+        {
+            continue;
+        }
+
+        BenchCase bc = {0};
+        bc.dst_width = dst_width;
+        bc.dst_height = dst_height;
+
+        // gdImage, packed pixels
+        bc.api = BENCH_GD_IMG;
+        bc.img = _bench_img_new(width, height);
+
+        for (int id = 0; bc.img && id < GD_METHOD_COUNT; ++id)
+        {
+            if (!methods[id])
+                continue;
+
+            bc.method = (gdInterpolationMethod) id;
+            bc.method_name = gd_interpolation_method_get_name(bc.method);
+            gd_img_set_interpolation_method(bc.img, bc.method);
+
+            _bench_case(&bc, fp, first);
+        }
+
+        if (bc.img)
+            gd_img_free(bc.img);
+
+        bc.img = NULL;
+
+        // pixbufs, RGB then RGBA
+        for (int alpha = 0; alpha < 2; ++alpha)
+        {
+            bc.pixbuf = _bench_pixbuf_new(width, height, alpha);
+            if (!bc.pixbuf)
+                continue;
+
+            bc.api = BENCH_GD_PIXBUF;
+
+            for (int id = 0; id < GD_METHOD_COUNT; ++id)
+            {
+                if (!methods[id])
+                    continue;
+
+                bc.method = (gdInterpolationMethod) id;
+                bc.method_name = gd_interpolation_method_get_name(bc.method);
+
+                _bench_case(&bc, fp, first);
+            }
+
+            bc.api = BENCH_GDK_PIXBUF;
+
+            for (guint i = 0; i < G_N_ELEMENTS(gdk_interps); ++i)
+            {
+                bc.interp = gdk_interps[i].interp;
+                bc.method_name = gdk_interps[i].name;
+
+                _bench_case(&bc, fp, first);
+            }
+
+            g_object_unref(bc.pixbuf);
+            bc.pixbuf = NULL;
+        }
+    }
+}
+
+static void _bench_rotate(int width, int height, FILE *fp, gboolean *first)
+{
+    // a vertical flip is a horizontal one and a half turn
+    static const struct
+    {
+        const char *name;
+        GdkPixbufRotation angle;
+        gboolean flip;
+    } transforms[] =
+    {
+        {"rotate-90", GDK_PIXBUF_ROTATE_CLOCKWISE, FALSE},
+        {"rotate-180", GDK_PIXBUF_ROTATE_UPSIDEDOWN, FALSE},
+        {"flip-h", GDK_PIXBUF_ROTATE_NONE, TRUE},
+        {"flip-v", GDK_PIXBUF_ROTATE_UPSIDEDOWN, TRUE},
+    };
+
+    for (int alpha = 0; alpha < 2; ++alpha)
+    {
+        BenchCase bc = {0};
+        bc.pixbuf = _bench_pixbuf_new(width, height, alpha);
+        if (!bc.pixbuf)
+            continue;
+
+        for (guint i = 0; i < G_N_ELEMENTS(transforms); ++i)
+        {
+            const gboolean turn = (transforms[i].angle
+                                   == GDK_PIXBUF_ROTATE_CLOCKWISE);
+
+            bc.method_name = transforms[i].name;
+            bc.angle = transforms[i].angle;
+            bc.flip = transforms[i].flip;
+            bc.dst_width = turn ? height : width;
+            bc.dst_height = turn ? width : height;
+
+            bc.api = BENCH_GD_ROTATE;
+            _bench_case(&bc, fp, first);
+
+            // quarter turns change the size
+            if (!turn)
+            {
+                bc.api = BENCH_GD_ROTATE_IN_PLACE;
+                _bench_case(&bc, fp, first);
+            }
+
+            bc.api = BENCH_GDK_ROTATE;
+            _bench_case(&bc, fp, first);
+        }
+
+        g_object_unref(bc.pixbuf);
+    }
+}
+
+static gboolean _bench_parse_methods(const char *list, gboolean *methods)
+{
+    if (!list)
+    {
+        for (int id = 0; id < GD_METHOD_COUNT; ++id)
+            methods[id] = TRUE;
+
+        return TRUE;
+    }
+
+    gchar **names = g_strsplit(list, ",", -1);
+    gboolean ret = TRUE;
+
+    for (int i = 0; names[i]; ++i)
+    {
+        gdInterpolationMethod id;
+
+        if (!gd_interpolation_method_from_name(names[i], &id))
+        {
+            fprintf(stderr, "gd-bench: unknown method \"%s\"\n", names[i]);
+            ret = FALSE;
+            break;
+        }
+
+        if (id < GD_METHOD_COUNT)
+            methods[id] = TRUE;
+    }
+
+    g_strfreev(names);
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    gchar *opt_sizes = NULL;
+    gchar *opt_methods = NULL;
+    gchar *opt_output = NULL;
+    gint opt_threads = 0;
+
+    GOptionEntry entries[] =
+    {
+        {"sizes", 's', 0, G_OPTION_ARG_STRING, &opt_sizes,
+         "Comma separated source sizes", "WxH,..."},
+        {"methods", 'm', 0, G_OPTION_ARG_STRING, &opt_methods,
+         "Comma separated libgd methods, all by default", "NAME,..."},
+        {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads,
+         "Number of threads, 0 for one per processor", "N"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+         "Write the results to FILE instead of stdout", "FILE"},
+        {NULL}
+    };
+
+    GOptionContext *context = g_option_context_new(NULL);
+    g_option_context_set_summary(context,
+        "Measures the scalers and the rotations and writes the results"
+        " as JSON.");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    GError *error = NULL;
+    gboolean ret = g_option_context_parse(context, &argc, &argv, &error);
+    g_option_context_free(context);
+
+    if (!ret)
+    {
+        fprintf(stderr, "gd-bench: %s\n", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+
+    gboolean methods[GD_METHOD_COUNT] = {0};
+
+    if (!_bench_parse_methods(opt_methods, methods))
+        return EXIT_FAILURE;
+
+    gchar **sizes = g_strsplit(opt_sizes ? opt_sizes
+                                         : _bench_default_sizes, ",", -1);
+
+    for (int i = 0; sizes[i]; ++i)
+    {
+        int width = 0;
+        int height = 0;
+
+        if (sscanf(sizes[i], "%dx%d", &width, &height) != 2
+            || width < 1 || height < 1
+            || width > VNR_MAX_SIZE || height > VNR_MAX_SIZE)
+        {
+            fprintf(stderr, "gd-bench: invalid size \"%s\"\n", sizes[i]);
+            g_strfreev(sizes);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *fp = stdout;
+
+    if (opt_output)
+    {
+        fp = fopen(opt_output, "w");
+
+        if (!fp)
+        {
+            fprintf(stderr, "gd-bench: can't open %s\n", opt_output);
+            g_strfreev(sizes);
+            return EXIT_FAILURE;
+        }
+    }
+
+    gd_resize_set_threads(opt_threads);
+
+    // 64 MB, larger than the caches
+    const gsize copy_size = 64 << 20;
+    const gdouble copy_time = _bench_memcpy(copy_size);
+
+    fprintf(fp, "{\n  \"threads\": %d,\n  \"memcpy_gbps\": %.3f,\n"
+                "  \"results\": [",
+            gd_resize_get_threads(), 2.0 * copy_size / copy_time / 1e9);
+
+    gboolean first = TRUE;
+
+    for (int i = 0; sizes[i]; ++i)
+    {
+        int width, height;
+        sscanf(sizes[i], "%dx%d", &width, &height);
+
+        _bench_size(width, height, methods, fp, &first);
+        _bench_rotate(width, height, fp, &first);
+        fflush(fp);
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (fp != stdout)
+        fclose(fp);
+
+    g_strfreev(sizes);
+    g_free(opt_sizes);
+    g_free(opt_methods);
+    g_free(opt_output);
+
+    return EXIT_SUCCESS;
+}
@@ -47,8 +47,11 @@
 #define PREFS_RELOAD_ON_SAVE    "reload-on-save"
 #define PREFS_JPEG_QUALITY      "jpeg-quality"
 #define PREFS_PNG_COMPRESSION   "png-compression"
+#define PREFS_PNG_PARALLEL      "png-parallel"
+#define PREFS_UNDO_MEMORY       "undo-memory"
 
 #define PREFS_RESIZE_LINK       "resize-link"
+#define PREFS_RESIZE_LINEAR     "resize-linear-light"
 
 
 #define VNR_PREFS_LOAD_KEY(PK, PT, KN, DEF)                              \
@@ -86,6 +89,10 @@ static void _prefs_reload_toggled(VnrPrefs *prefs, GtkToggleButton *togglebtn);
 static void _prefs_jpeg_quality_changed(VnrPrefs *prefs,
                                         GtkSpinButton *spinbtn);
 static void _prefs_png_comp_changed(VnrPrefs *prefs, GtkSpinButton *spinbtn);
+static void _prefs_png_parallel_toggled(VnrPrefs *prefs,
+                                        GtkToggleButton *togglebtn);
+static void _prefs_undo_memory_changed(VnrPrefs *prefs,
+                                       GtkSpinButton *spinbtn);
 
 
 // creation -------------------------------------------------------------------
@@ -138,8 +145,11 @@ static void vnr_prefs_set_default(VnrPrefs *prefs)
     prefs->reload_on_save = FALSE;
     prefs->jpeg_quality = 90;
     prefs->png_compression = 9;
+    prefs->png_parallel = TRUE;
+    prefs->undo_memory = 256;
 
     prefs->resize_link = TRUE;
+    prefs->resize_linear_light = FALSE;
 }
 
 static gboolean vnr_prefs_load(VnrPrefs *prefs)
@@ -205,9 +215,15 @@ static gboolean vnr_prefs_load(VnrPrefs *prefs)
                        PREFS_JPEG_QUALITY, 90);
     VNR_PREFS_LOAD_KEY(png_compression, integer,
                        PREFS_PNG_COMPRESSION, 9);
+    VNR_PREFS_LOAD_KEY(png_parallel, boolean,
+                       PREFS_PNG_PARALLEL, TRUE);
+    VNR_PREFS_LOAD_KEY(undo_memory, integer,
+                       PREFS_UNDO_MEMORY, 256);
 
     VNR_PREFS_LOAD_KEY(resize_link, boolean,
                        PREFS_RESIZE_LINK, TRUE);
+    VNR_PREFS_LOAD_KEY(resize_linear_light, boolean,
+                       PREFS_RESIZE_LINEAR, FALSE);
 
     g_key_file_free(conf);
 
@@ -262,9 +278,15 @@ gboolean vnr_prefs_save(VnrPrefs *prefs)
                            prefs->jpeg_quality);
     g_key_file_set_integer(conf, PREFS_GROUP, PREFS_PNG_COMPRESSION,
                            prefs->png_compression);
+    g_key_file_set_boolean(conf, PREFS_GROUP, PREFS_PNG_PARALLEL,
+                           prefs->png_parallel);
+    g_key_file_set_integer(conf, PREFS_GROUP, PREFS_UNDO_MEMORY,
+                           prefs->undo_memory);
 
     g_key_file_set_boolean(conf, PREFS_GROUP, PREFS_RESIZE_LINK,
                            prefs->resize_link);
+    g_key_file_set_boolean(conf, PREFS_GROUP, PREFS_RESIZE_LINEAR,
+                           prefs->resize_linear_light);
 
     if (g_mkdir_with_parents(dir, 0700) != 0)
         g_warning("Error creating config file's parent directory (%s)\n", dir);
@@ -469,6 +491,19 @@ void vnr_prefs_dialog_run(VnrPrefs *prefs)
     g_signal_connect_swapped(G_OBJECT(spinbtn), "value-changed",
                              G_CALLBACK(_prefs_png_comp_changed), prefs);
 
+    // png compression on all the cores
+    togglebtn = GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder,
+                                                        "png_parallel"));
+    gtk_toggle_button_set_active(togglebtn, prefs->png_parallel);
+    g_signal_connect_swapped(G_OBJECT(togglebtn), "toggled",
+                             G_CALLBACK(_prefs_png_parallel_toggled), prefs);
+
+    // memory of the undo previews
+    spinbtn = GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "undo_memory"));
+    gtk_spin_button_set_value(spinbtn, (gdouble) prefs->undo_memory);
+    g_signal_connect_swapped(G_OBJECT(spinbtn), "value-changed",
+                             G_CALLBACK(_prefs_undo_memory_changed), prefs);
+
     // ------------------------------------------------------------------------
 
     // window signals
@@ -580,4 +615,18 @@ static void _prefs_png_comp_changed(VnrPrefs *prefs, GtkSpinButton *spinbtn)
     vnr_prefs_save(prefs);
 }
 
+static void _prefs_png_parallel_toggled(VnrPrefs *prefs,
+                                        GtkToggleButton *togglebtn)
+{
+    prefs->png_parallel = gtk_toggle_button_get_active(togglebtn);
+    vnr_prefs_save(prefs);
+}
+
+static void _prefs_undo_memory_changed(VnrPrefs *prefs, GtkSpinButton *spinbtn)
+{
+    prefs->undo_memory = gtk_spin_button_get_value_as_int(spinbtn);
+    vnr_prefs_save(prefs);
+    window_preferences_apply(VNR_WINDOW(prefs->window));
+}
+
 
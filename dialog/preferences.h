@@ -108,8 +108,11 @@ struct _VnrPrefs
     gboolean reload_on_save;
     gint jpeg_quality;
     gint png_compression;
+    gboolean png_parallel;
+    gint undo_memory;
 
     gboolean resize_link;
+    gboolean resize_linear_light;
 };
 
 struct _VnrPrefsClass
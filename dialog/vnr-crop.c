@@ -179,8 +179,10 @@ static GtkWidget* _vnr_crop_dlg_new(VnrCrop *crop)
                                 width,
                                 height);
 
+    // the view may show an edit preview smaller than the image
     uni_pixbuf_scale_blend(original, preview, 0, 0, width, height, 0, 0,
-                           crop->zoom, GDK_INTERP_BILINEAR, 0, 0);
+                           width / gdk_pixbuf_get_width(original),
+                           GDK_INTERP_BILINEAR, 0, 0);
     crop->preview_pixbuf = preview;
 
     crop->image = gtk_drawing_area_new();
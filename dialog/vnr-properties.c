@@ -25,7 +25,25 @@
 
 G_DEFINE_TYPE(VnrPropertiesDialog, vnr_propsdlg, GTK_TYPE_DIALOG)
 
-static void vnr_propsdlg_update_metadata(VnrPropertiesDialog *dialog);
+// Read in a worker thread, so that navigating doesn't wait for the
+// metadata of each image while the dialog is shown.
+typedef struct _PropsLoad
+{
+    gchar *path;
+    GdkPixbuf *pixbuf;
+
+    goffset size;
+    const gchar *type;
+    GdkPixbuf *thumbnail;
+    GPtrArray *metadata;    // label and value pairs
+
+} PropsLoad;
+
+static void vnr_propsdlg_cancel(VnrPropertiesDialog *dialog);
+static void vnr_propsdlg_update_labels(VnrPropertiesDialog *dialog);
+static void vnr_propsdlg_clear_metadata(VnrPropertiesDialog *dialog);
+static void vnr_cb_add_metadata(const char *label,
+                                const char *value, void *user_data);
 
 static gboolean key_press_cb(GtkWidget *widget,
                              GdkEventKey *event, gpointer user_data)
@@ -51,6 +69,7 @@ static void get_file_info(gchar *filename, goffset *size, const gchar **type)
 
     if (fileinfo == NULL)
     {
+        g_object_unref(file);
         return;
     }
 
@@ -61,6 +80,17 @@ static void get_file_info(gchar *filename, goffset *size, const gchar **type)
     g_object_unref(fileinfo);
 }
 
+static GdkPixbuf* get_thumbnail(GdkPixbuf *original)
+{
+    int width = gdk_pixbuf_get_width(original);
+    int height = gdk_pixbuf_get_height(original);
+
+    vnr_tools_fit_to_size(&height, &width, 100, 100);
+
+    return gdk_pixbuf_scale_simple(original, width, height,
+                                   GDK_INTERP_NEAREST);
+}
+
 static void set_new_pixbuf(VnrPropertiesDialog *dialog, GdkPixbuf *original)
 {
     if (dialog->thumbnail != NULL)
@@ -78,15 +108,124 @@ static void set_new_pixbuf(VnrPropertiesDialog *dialog, GdkPixbuf *original)
         return;
     }
 
-    int width, height;
+    dialog->thumbnail = get_thumbnail(original);
+}
 
-    width = gdk_pixbuf_get_width(original);
-    height = gdk_pixbuf_get_height(original);
+// load -----------------------------------------------------------------------
 
-    vnr_tools_fit_to_size(&height, &width, 100, 100);
+static void props_load_free(PropsLoad *load)
+{
+    g_free(load->path);
+    g_free((gchar*) load->type);
+
+    if (load->pixbuf)
+        g_object_unref(load->pixbuf);
+
+    if (load->thumbnail)
+        g_object_unref(load->thumbnail);
+
+    g_ptr_array_unref(load->metadata);
+    g_free(load);
+}
+
+static void props_add_metadata(const char *label,
+                               const char *value, void *user_data)
+{
+    GPtrArray *metadata = user_data;
+
+    g_ptr_array_add(metadata, g_strdup(label));
+    g_ptr_array_add(metadata, g_strdup(value));
+}
+
+static void props_load_thread(GTask *task, gpointer source_object,
+                              gpointer task_data,
+                              GCancellable *cancellable)
+{
+    (void) source_object;
+
+    PropsLoad *load = task_data;
+
+    get_file_info(load->path, &load->size, &load->type);
+
+    if (load->pixbuf && !g_cancellable_is_cancelled(cancellable))
+        load->thumbnail = get_thumbnail(load->pixbuf);
+
+    if (!g_cancellable_is_cancelled(cancellable))
+        uni_read_exiv2_map(load->path, props_add_metadata, load->metadata);
+
+    if (g_task_return_error_if_cancelled(task))
+        return;
 
-    dialog->thumbnail = gdk_pixbuf_scale_simple(original, width, height,
-                                                GDK_INTERP_NEAREST);
+    g_task_return_boolean(task, TRUE);
+}
+
+static void props_load_ready(GObject *source_object,
+                             GAsyncResult *result,
+                             gpointer user_data)
+{
+    (void) user_data;
+
+    VnrPropertiesDialog *dialog = VNR_PROPERTIES_DIALOG(source_object);
+    GTask *task = G_TASK(result);
+
+    // cancelled, the dialog shows another image
+    if (!g_task_propagate_boolean(task, NULL)
+        || g_task_get_cancellable(task) != dialog->cancellable)
+        return;
+
+    g_clear_object(&dialog->cancellable);
+
+    PropsLoad *load = g_task_get_task_data(task);
+
+    if (load->type == NULL && load->size == 0)
+    {
+        vnr_propsdlg_clear(dialog);
+        return;
+    }
+
+    if (load->thumbnail)
+    {
+        if (dialog->thumbnail)
+            g_object_unref(dialog->thumbnail);
+
+        dialog->thumbnail = load->thumbnail;
+        load->thumbnail = NULL;
+
+        gtk_image_set_from_pixbuf(GTK_IMAGE(dialog->image),
+                                  dialog->thumbnail);
+    }
+    else
+    {
+        set_new_pixbuf(dialog, NULL);
+    }
+
+    gchar *filesize_str = g_format_size(load->size);
+    gchar *filetype_desc = g_content_type_get_description(load->type);
+
+    gtk_label_set_text(GTK_LABEL(dialog->type_label), filetype_desc);
+    gtk_label_set_text(GTK_LABEL(dialog->size_label), filesize_str);
+
+    g_free(filesize_str);
+    g_free(filetype_desc);
+
+    vnr_propsdlg_clear_metadata(dialog);
+
+    for (guint i = 0; i + 1 < load->metadata->len; i += 2)
+    {
+        vnr_cb_add_metadata(g_ptr_array_index(load->metadata, i),
+                            g_ptr_array_index(load->metadata, i + 1),
+                            dialog);
+    }
+}
+
+static void vnr_propsdlg_cancel(VnrPropertiesDialog *dialog)
+{
+    if (dialog->cancellable)
+    {
+        g_cancellable_cancel(dialog->cancellable);
+        g_object_unref(dialog->cancellable);
+        dialog->cancellable = NULL;
+    }
 }
 
 static void vnr_propsdlg_class_init(VnrPropertiesDialogClass *klass)
@@ -314,42 +453,37 @@ static void vnr_propsdlg_init(VnrPropertiesDialog *dialog)
 
 void vnr_propsdlg_update(VnrPropertiesDialog *dialog)
 {
+    vnr_propsdlg_cancel(dialog);
+
     VnrFile *current = window_get_current_file(dialog->window);
     if (!current)
         return;
 
-    gchar *filetype_desc = NULL;
-    gchar *filesize_str = NULL;
-
-    goffset filesize = 0;
-    const gchar *filetype = NULL;
-    get_file_info((gchar*) current->path, &filesize, &filetype);
-
-    if (filetype == NULL && filesize == 0)
-    {
-        vnr_propsdlg_clear(dialog);
-        return;
-    }
-
-    vnr_propsdlg_update_image(dialog);
-    vnr_propsdlg_update_metadata(dialog);
-
-    filesize_str = g_format_size(filesize);
-
-    filetype_desc = g_content_type_get_description(filetype);
-
+    // what is at hand is shown at once, the rest once read
     gtk_label_set_text(GTK_LABEL(dialog->name_label),
                        (gchar *)current->display_name);
 
     gtk_label_set_text(GTK_LABEL(dialog->location_label),
                        (gchar *)current->path);
 
-    gtk_label_set_text(GTK_LABEL(dialog->type_label), filetype_desc);
-    gtk_label_set_text(GTK_LABEL(dialog->size_label), filesize_str);
+    vnr_propsdlg_update_labels(dialog);
 
-    g_free(filesize_str);
-    g_free((gchar*) filetype);
-    g_free(filetype_desc);
+    PropsLoad *load = g_new0(PropsLoad, 1);
+    load->path = g_strdup(current->path);
+    load->metadata = g_ptr_array_new_with_free_func(g_free);
+
+    GdkPixbuf *pixbuf = uni_image_view_get_pixbuf(
+                                    UNI_IMAGE_VIEW(dialog->window->view));
+    if (pixbuf)
+        load->pixbuf = g_object_ref(pixbuf);
+
+    dialog->cancellable = g_cancellable_new();
+
+    GTask *task = g_task_new(dialog, dialog->cancellable,
+                             props_load_ready, NULL);
+    g_task_set_task_data(task, load, (GDestroyNotify) props_load_free);
+    g_task_run_in_thread(task, props_load_thread);
+    g_object_unref(task);
 }
 
 static void vnr_propsdlg_clear_metadata(VnrPropertiesDialog *dialog)
@@ -406,18 +540,7 @@ static void vnr_cb_add_metadata(const char *label,
     gtk_widget_show(temp_label);
 }
 
-static void vnr_propsdlg_update_metadata(VnrPropertiesDialog *dialog)
-{
-    vnr_propsdlg_clear_metadata(dialog);
-
-    VnrFile *current = window_get_current_file(dialog->window);
-    if (!current)
-        return;
-
-    uni_read_exiv2_map(current->path, vnr_cb_add_metadata, (void*) dialog);
-}
-
-void vnr_propsdlg_update_image(VnrPropertiesDialog *dialog)
+static void vnr_propsdlg_update_labels(VnrPropertiesDialog *dialog)
 {
     VnrFile *current = window_get_current_file(dialog->window);
     if (!current)
@@ -434,11 +557,6 @@ void vnr_propsdlg_update_image(VnrPropertiesDialog *dialog)
 
     gtk_label_set_text(GTK_LABEL(dialog->modified_label), date_modified);
 
-    set_new_pixbuf(
-            dialog,
-            uni_image_view_get_pixbuf(UNI_IMAGE_VIEW(dialog->window->view)));
-    gtk_image_set_from_pixbuf(GTK_IMAGE(dialog->image), dialog->thumbnail);
-
     width_str = g_strdup_printf("%i px",
                                 dialog->window->current_image_width);
     height_str = g_strdup_printf("%i px",
@@ -451,8 +569,30 @@ void vnr_propsdlg_update_image(VnrPropertiesDialog *dialog)
     g_free(height_str);
 }
 
+void vnr_propsdlg_update_image(VnrPropertiesDialog *dialog)
+{
+    // the pending load would show the thumbnail from before the edit
+    if (dialog->cancellable)
+    {
+        vnr_propsdlg_update(dialog);
+        return;
+    }
+
+    if (!window_get_current_file(dialog->window))
+        return;
+
+    vnr_propsdlg_update_labels(dialog);
+
+    set_new_pixbuf(
+            dialog,
+            uni_image_view_get_pixbuf(UNI_IMAGE_VIEW(dialog->window->view)));
+    gtk_image_set_from_pixbuf(GTK_IMAGE(dialog->image), dialog->thumbnail);
+}
+
 void vnr_propsdlg_clear(VnrPropertiesDialog *dialog)
 {
+    vnr_propsdlg_cancel(dialog);
+
     set_new_pixbuf(dialog, NULL);
     vnr_propsdlg_clear_metadata(dialog);
 
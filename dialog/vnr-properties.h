@@ -50,6 +50,7 @@ struct _VnrPropertiesDialog
     GtkWidget *modified_label;
 
     GdkPixbuf *thumbnail;
+    GCancellable *cancellable;
 
     VnrWindow *window;
 };
@@ -29,6 +29,8 @@ static void _on_width_value_changed(GtkSpinButton *spinbutton,
 static void _on_height_value_changed(GtkSpinButton *spinbutton,
                                      VnrResize *resize);
 static void _on_link_check_toggled(GtkWidget *checkbutton, VnrResize *resize);
+static void _on_linear_check_toggled(GtkWidget *checkbutton,
+                                     VnrResize *resize);
 
 
 // creation -------------------------------------------------------------------
@@ -64,6 +66,8 @@ gboolean vnr_resize_run(VnrResize *resize)
             gtk_spin_button_get_value_as_int(resize->spin_width);
     resize->new_height =
             gtk_spin_button_get_value_as_int(resize->spin_height);
+    resize->linear_light = gtk_toggle_button_get_active(
+                                GTK_TOGGLE_BUTTON(resize->linear_check));
 
     gtk_widget_destroy(dialog);
 
@@ -149,6 +153,19 @@ static GtkWidget* _vnr_resize_dlg_new(VnrResize *resize)
     gtk_grid_attach(GTK_GRID(grid),
                     GTK_WIDGET(resize->spin_height), 1, row, 1, 1);
 
+    ++row;
+
+    resize->linear_check = gtk_check_button_new_with_label(
+                                                    _("Linear light"));
+    gtk_widget_set_tooltip_text(
+                resize->linear_check,
+                _("Filter linear light instead of sRGB values, fine details"
+                  " keep their brightness when downscaling, slower"));
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(resize->linear_check),
+                                 prefs->resize_linear_light);
+    gtk_grid_attach(GTK_GRID(grid),
+                    resize->linear_check, 1, row, 2, 1);
+
     gtk_dialog_add_buttons(GTK_DIALOG(dialog),
                            _("Cancel"), GTK_RESPONSE_CANCEL,
                            _("Resize"), GTK_RESPONSE_ACCEPT,
@@ -160,6 +177,8 @@ static GtkWidget* _vnr_resize_dlg_new(VnrResize *resize)
                      G_CALLBACK(_on_height_value_changed), resize);
     g_signal_connect(resize->link_check, "toggled",
                      G_CALLBACK(_on_link_check_toggled), resize);
+    g_signal_connect(resize->linear_check, "toggled",
+                     G_CALLBACK(_on_linear_check_toggled), resize);
 
     gtk_widget_show_all(dialog);
 
@@ -195,4 +214,12 @@ static void _on_link_check_toggled(GtkWidget *checkbutton, VnrResize *resize)
                                         GTK_TOGGLE_BUTTON(checkbutton));
 }
 
+static void _on_linear_check_toggled(GtkWidget *checkbutton,
+                                     VnrResize *resize)
+{
+    VnrPrefs *prefs = resize->window->prefs;
+    prefs->resize_linear_light = gtk_toggle_button_get_active(
+                                        GTK_TOGGLE_BUTTON(checkbutton));
+}
+
 
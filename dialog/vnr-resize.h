@@ -40,10 +40,12 @@ struct _VnrResize
     gdouble new_width;
     gdouble new_height;
     gdouble ratio;
+    gboolean linear_light;
 
     GtkSpinButton *spin_width;
     GtkSpinButton *spin_height;
     GtkWidget *link_check;
+    GtkWidget *linear_check;
 };
 
 struct _VnrResizeClass
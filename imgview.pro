@@ -11,6 +11,8 @@ PKGCONFIG += gdk-pixbuf-2.0
 PKGCONFIG += glib-2.0
 PKGCONFIG += gio-2.0
 PKGCONFIG += exiv2
+PKGCONFIG += libjpeg
+PKGCONFIG += zlib
 PKGCONFIG += tinyui
 
 HEADERS = \
@@ -21,9 +23,11 @@ HEADERS = \
     dialog/vnr-properties.h \
     dialog/vnr-resize.h \
     dialog/xfce-filename-input.h \
+    libgd/gd-filter.h \
     libgd/gd-helpers.h \
     libgd/gd-image.h \
     libgd/gd-resize.h \
+    libgd/gd-rotate.h \
     uni/uni-anim-view.h \
     uni/uni-cache.h \
     uni/uni-dragger.h \
@@ -34,6 +38,10 @@ HEADERS = \
     config.h.in \
     file.h \
     list.h \
+    vnr-batch.h \
+    vnr-edits.h \
+    vnr-jpeg.h \
+    vnr-png.h \
     vnr-tools.h \
     window.h \
 
@@ -45,9 +53,11 @@ SOURCES = \
     dialog/vnr-properties.c \
     dialog/vnr-resize.c \
     dialog/xfce-filename-input.c \
+    libgd/gd-filter.c \
     libgd/gd-helpers.c \
     libgd/gd-image.c \
     libgd/gd-resize.c \
+    libgd/gd-rotate.c \
     uni/uni-anim-view.c \
     uni/uni-cache.c \
     uni/uni-dragger.c \
@@ -59,6 +69,10 @@ SOURCES = \
     file.c \
     list.c \
     main.c \
+    vnr-batch.c \
+    vnr-edits.c \
+    vnr-jpeg.c \
+    vnr-png.c \
     vnr-tools.c \
     window.c \
 
@@ -0,0 +1,570 @@
+#include "config.h"
+#include "gd-filter.h"
+
+#include "gd-resize.h"
+#include "gd-helpers.h"
+#include <math.h>
+#include <string.h>
+
+/*
+    Colour filters are a 3x4 matrix on r, g, b followed by a per channel
+    lookup table, either of them may be omitted. Alpha is copied.
+
+    The matrix is applied in fixed point: the weights are 4.12 shorts and
+    the offset multiplies a constant GD_COLOR_UNIT lane, so each output
+    channel is two pmaddwd pairs (r, g) (b, unit). The SSE4.1 and AVX2
+    versions are selected at run time and give the same result as the
+    scalar version. Lines are independent, they run on the scaling thread
+    pool and dst may be src.
+*/
+
+#define GD_COLOR_BITS 12
+#define GD_COLOR_ONE (1 << GD_COLOR_BITS)
+#define GD_COLOR_UNIT 256
+
+// the rounding term of the shift, added to the offset
+#define GD_COLOR_ROUND (GD_COLOR_ONE / 2 / GD_COLOR_UNIT)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GD_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+    int16_t coef[3][4];     // r, g, b weights and offset of each output
+
+} gdColorFixed;
+
+static int16_t _gd_color_to_fixed(float value, float scale, int round)
+{
+    const long q = lrintf(value * scale) + round;
+
+    return (int16_t) CLAMP(q, INT16_MIN, INT16_MAX);
+}
+
+static void _gd_color_fixed_init(gdColorFixed *fixed,
+                                 const gdColorMatrix *mat)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            fixed->coef[i][j] = _gd_color_to_fixed(mat->m[i][j],
+                                                   GD_COLOR_ONE, 0);
+
+        fixed->coef[i][3] = _gd_color_to_fixed(
+                                        mat->m[i][3],
+                                        GD_COLOR_ONE / GD_COLOR_UNIT,
+                                        GD_COLOR_ROUND);
+    }
+}
+
+// matrices -------------------------------------------------------------------
+
+/**
+ * gd_color_matrix_identity:
+ * @mat: the matrix to set
+ **/
+void gd_color_matrix_identity(gdColorMatrix *mat)
+{
+    memset(mat, 0, sizeof(*mat));
+
+    for (int i = 0; i < 3; ++i)
+        mat->m[i][i] = 1.0f;
+}
+
+/**
+ * gd_color_matrix_multiply:
+ * @mat: the result, may be @a or @b
+ * @a: the matrix applied second
+ * @b: the matrix applied first
+ **/
+void gd_color_matrix_multiply(gdColorMatrix *mat,
+                              const gdColorMatrix *a,
+                              const gdColorMatrix *b)
+{
+    gdColorMatrix result;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            float value = (j == 3) ? a->m[i][3] : 0.0f;
+
+            for (int k = 0; k < 3; ++k)
+                value += a->m[i][k] * b->m[k][j];
+
+            result.m[i][j] = value;
+        }
+    }
+
+    *mat = result;
+}
+
+/**
+ * gd_color_matrix_saturation:
+ * @mat: the matrix to set
+ * @saturation: 0 for grayscale, 1 for the identity
+ *
+ * Saturation matrix with the luminance weights of Paul Haeberli's
+ * "Matrix Operations for Image Processing".
+ **/
+void gd_color_matrix_saturation(gdColorMatrix *mat, float saturation)
+{
+    static const float weights[3] = {0.3086f, 0.6094f, 0.0820f};
+
+    memset(mat, 0, sizeof(*mat));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+            mat->m[i][j] = (1.0f - saturation) * weights[j];
+
+        mat->m[i][i] += saturation;
+    }
+}
+
+/**
+ * gd_color_matrix_brightness_contrast:
+ * @mat: the matrix to set
+ * @brightness: added to each channel, -1 to 1
+ * @contrast: scale around mid gray, 1 for the identity
+ **/
+void gd_color_matrix_brightness_contrast(gdColorMatrix *mat,
+                                         float brightness, float contrast)
+{
+    gd_color_matrix_identity(mat);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        mat->m[i][i] = contrast;
+        mat->m[i][3] = 127.5f * (1.0f - contrast) + 255.0f * brightness;
+    }
+}
+
+/**
+ * gd_color_matrix_sepia:
+ * @mat: the matrix to set
+ **/
+void gd_color_matrix_sepia(gdColorMatrix *mat)
+{
+    static const gdColorMatrix sepia =
+    {
+        {
+            {0.393f, 0.769f, 0.189f, 0.0f},
+            {0.349f, 0.686f, 0.168f, 0.0f},
+            {0.272f, 0.534f, 0.131f, 0.0f},
+        }
+    };
+
+    *mat = sepia;
+}
+
+// lookup tables --------------------------------------------------------------
+
+/**
+ * gd_color_lut_identity:
+ * @lut: the table to set
+ **/
+void gd_color_lut_identity(gdColorLut *lut)
+{
+    for (int i = 0; i < 256; ++i)
+        lut->table[0][i] = lut->table[1][i] = lut->table[2][i] = i;
+}
+
+/**
+ * gd_color_lut_gamma:
+ * @lut: the table to set
+ * @gamma: the exponent, out = in ^ (1 / gamma)
+ **/
+void gd_color_lut_gamma(gdColorLut *lut, float gamma)
+{
+    const double exponent = 1.0 / MAX(gamma, 0.01f);
+
+    for (int i = 0; i < 256; ++i)
+    {
+        const uint8_t value = uchar_clamp(
+                                255.0 * pow(i / 255.0, exponent), 255);
+
+        lut->table[0][i] = lut->table[1][i] = lut->table[2][i] = value;
+    }
+}
+
+// rows -----------------------------------------------------------------------
+
+typedef void (*gdColorRow)(const gdColorFixed *fixed,
+                           const uint8_t *src, uint8_t *dst,
+                           unsigned int width, int channels);
+
+// all three outputs are computed before the store, so dst may be src
+static void _gdColorRow_c(const gdColorFixed *fixed,
+                          const uint8_t *src, uint8_t *dst,
+                          unsigned int width, int channels)
+{
+    for (unsigned int x = 0; x < width; ++x)
+    {
+        const int r = src[0];
+        const int g = src[1];
+        const int b = src[2];
+        int out[3];
+
+        for (int i = 0; i < 3; ++i)
+        {
+            const int32_t acc = fixed->coef[i][0] * r
+                                + fixed->coef[i][1] * g
+                                + fixed->coef[i][2] * b
+                                + fixed->coef[i][3] * GD_COLOR_UNIT;
+
+            out[i] = CLAMP(acc >> GD_COLOR_BITS, 0, 255);
+        }
+
+        dst[0] = out[0];
+        dst[1] = out[1];
+        dst[2] = out[2];
+
+        if (channels == 4)
+            dst[3] = src[3];
+
+        src += channels;
+        dst += channels;
+    }
+}
+
+#ifdef GD_SIMD_X86
+
+#define GD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define GD_TARGET_AVX2 __attribute__((target("avx2")))
+
+#define GD_INLINE inline __attribute__((always_inline))
+
+// [r g b x] pixels to [r0 r1 r2 r3 g0 .. b3 b0 .. b3] bytes, the x bytes
+// are replaced by the offset lane
+static GD_INLINE GD_TARGET_SSE41
+__m128i _gd_color_px4_sse41(__m128i px, const __m128i coef[3])
+{
+    const __m128i unit = _mm_set1_epi16(GD_COLOR_UNIT);
+    const __m128i zero = _mm_setzero_si128();
+
+    const __m128i lo = _mm_blend_epi16(_mm_unpacklo_epi8(px, zero),
+                                       unit, 0x88);
+    const __m128i hi = _mm_blend_epi16(_mm_unpackhi_epi8(px, zero),
+                                       unit, 0x88);
+
+    __m128i out[3];
+
+    for (int i = 0; i < 3; ++i)
+    {
+        const __m128i sum = _mm_hadd_epi32(_mm_madd_epi16(lo, coef[i]),
+                                           _mm_madd_epi16(hi, coef[i]));
+        out[i] = _mm_srai_epi32(sum, GD_COLOR_BITS);
+    }
+
+    return _mm_packus_epi16(_mm_packs_epi32(out[0], out[1]),
+                            _mm_packs_epi32(out[2], out[2]));
+}
+
+static GD_TARGET_SSE41
+void _gdColorRow_sse41(const gdColorFixed *fixed,
+                       const uint8_t *src, uint8_t *dst,
+                       unsigned int width, int channels)
+{
+    __m128i coef[3];
+
+    for (int i = 0; i < 3; ++i)
+        coef[i] = _mm_setr_epi16(fixed->coef[i][0], fixed->coef[i][1],
+                                 fixed->coef[i][2], fixed->coef[i][3],
+                                 fixed->coef[i][0], fixed->coef[i][1],
+                                 fixed->coef[i][2], fixed->coef[i][3]);
+
+    unsigned int x = 0;
+
+    if (channels == 4)
+    {
+        const __m128i rgba = _mm_setr_epi8(0, 4, 8, -128, 1, 5, 9, -128,
+                                           2, 6, 10, -128, 3, 7, 11, -128);
+        const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+        for (; x + 4 <= width; x += 4)
+        {
+            const __m128i px = _mm_loadu_si128((const __m128i*) src);
+            const __m128i out = _mm_shuffle_epi8(
+                                    _gd_color_px4_sse41(px, coef), rgba);
+
+            _mm_storeu_si128((__m128i*) dst,
+                             _mm_or_si128(out, _mm_and_si128(px, alpha)));
+
+            src += 16;
+            dst += 16;
+        }
+    }
+    else
+    {
+        const __m128i spread = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128,
+                                             6, 7, 8, -128, 9, 10, 11, -128);
+        const __m128i rgb = _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6,
+                                          10, 3, 7, 11, -128, -128, -128,
+                                          -128);
+
+        // 16 bytes are read for 12
+        for (; x + 6 <= width; x += 4)
+        {
+            const __m128i px = _mm_shuffle_epi8(
+                            _mm_loadu_si128((const __m128i*) src), spread);
+            const __m128i out = _mm_shuffle_epi8(
+                                    _gd_color_px4_sse41(px, coef), rgb);
+            const uint32_t tail = _mm_extract_epi32(out, 2);
+
+            _mm_storel_epi64((__m128i*) dst, out);
+            memcpy(dst + 8, &tail, sizeof(tail));
+
+            src += 12;
+            dst += 12;
+        }
+    }
+
+    _gdColorRow_c(fixed, src, dst, width - x, channels);
+}
+
+// same as _gd_color_px4_sse41 on each 128 bit lane
+static GD_INLINE GD_TARGET_AVX2
+__m256i _gd_color_px8_avx2(__m256i px, const __m256i coef[3])
+{
+    const __m256i unit = _mm256_set1_epi16(GD_COLOR_UNIT);
+    const __m256i zero = _mm256_setzero_si256();
+
+    const __m256i lo = _mm256_blend_epi16(_mm256_unpacklo_epi8(px, zero),
+                                          unit, 0x88);
+    const __m256i hi = _mm256_blend_epi16(_mm256_unpackhi_epi8(px, zero),
+                                          unit, 0x88);
+
+    __m256i out[3];
+
+    for (int i = 0; i < 3; ++i)
+    {
+        const __m256i sum = _mm256_hadd_epi32(
+                                        _mm256_madd_epi16(lo, coef[i]),
+                                        _mm256_madd_epi16(hi, coef[i]));
+        out[i] = _mm256_srai_epi32(sum, GD_COLOR_BITS);
+    }
+
+    return _mm256_packus_epi16(_mm256_packs_epi32(out[0], out[1]),
+                               _mm256_packs_epi32(out[2], out[2]));
+}
+
+static GD_TARGET_AVX2
+void _gdColorRow_avx2(const gdColorFixed *fixed,
+                      const uint8_t *src, uint8_t *dst,
+                      unsigned int width, int channels)
+{
+    __m256i coef[3];
+
+    for (int i = 0; i < 3; ++i)
+        coef[i] = _mm256_setr_epi16(
+                    fixed->coef[i][0], fixed->coef[i][1],
+                    fixed->coef[i][2], fixed->coef[i][3],
+                    fixed->coef[i][0], fixed->coef[i][1],
+                    fixed->coef[i][2], fixed->coef[i][3],
+                    fixed->coef[i][0], fixed->coef[i][1],
+                    fixed->coef[i][2], fixed->coef[i][3],
+                    fixed->coef[i][0], fixed->coef[i][1],
+                    fixed->coef[i][2], fixed->coef[i][3]);
+
+    unsigned int x = 0;
+
+    if (channels == 4)
+    {
+        const __m256i rgba = _mm256_broadcastsi128_si256(
+                                _mm_setr_epi8(0, 4, 8, -128, 1, 5, 9, -128,
+                                              2, 6, 10, -128, 3, 7, 11,
+                                              -128));
+        const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+
+        for (; x + 8 <= width; x += 8)
+        {
+            const __m256i px = _mm256_loadu_si256((const __m256i*) src);
+            const __m256i out = _mm256_shuffle_epi8(
+                                    _gd_color_px8_avx2(px, coef), rgba);
+
+            _mm256_storeu_si256(
+                        (__m256i*) dst,
+                        _mm256_or_si256(out, _mm256_and_si256(px, alpha)));
+
+            src += 32;
+            dst += 32;
+        }
+    }
+    else
+    {
+        const __m256i spread = _mm256_broadcastsi128_si256(
+                                _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128,
+                                              6, 7, 8, -128, 9, 10, 11,
+                                              -128));
+        const __m256i rgb = _mm256_broadcastsi128_si256(
+                                _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6,
+                                              10, 3, 7, 11, -128, -128,
+                                              -128, -128));
+
+        // 4 pixels in each lane, 28 bytes are read for 24
+        for (; x + 10 <= width; x += 8)
+        {
+            __m256i px = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(
+                        _mm_loadu_si128((const __m128i*) src)),
+                    _mm_loadu_si128((const __m128i*) (src + 12)), 1);
+            px = _mm256_shuffle_epi8(px, spread);
+
+            const __m256i out = _mm256_shuffle_epi8(
+                                    _gd_color_px8_avx2(px, coef), rgb);
+            const __m128i out_lo = _mm256_castsi256_si128(out);
+            const __m128i out_hi = _mm256_extracti128_si256(out, 1);
+            const uint32_t tail_lo = _mm_extract_epi32(out_lo, 2);
+            const uint32_t tail_hi = _mm_extract_epi32(out_hi, 2);
+
+            _mm_storel_epi64((__m128i*) dst, out_lo);
+            memcpy(dst + 8, &tail_lo, sizeof(tail_lo));
+            _mm_storel_epi64((__m128i*) (dst + 12), out_hi);
+            memcpy(dst + 20, &tail_hi, sizeof(tail_hi));
+
+            src += 24;
+            dst += 24;
+        }
+    }
+
+    _gdColorRow_c(fixed, src, dst, width - x, channels);
+}
+
+#endif // GD_SIMD_X86
+
+static gdColorRow _gd_get_color_row()
+{
+    static gdColorRow row = _gdColorRow_c;
+    static gsize init = 0;
+
+    if (g_once_init_enter(&init))
+    {
+#ifdef GD_SIMD_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            row = _gdColorRow_avx2;
+        else if (__builtin_cpu_supports("sse4.1"))
+            row = _gdColorRow_sse41;
+#endif
+
+        g_once_init_leave(&init, 1);
+    }
+
+    return row;
+}
+
+static void _gd_color_lut_row(const gdColorLut *lut,
+                              const uint8_t *src, uint8_t *dst,
+                              unsigned int width, int channels)
+{
+    const uint8_t *table_r = lut->table[0];
+    const uint8_t *table_g = lut->table[1];
+    const uint8_t *table_b = lut->table[2];
+
+    for (unsigned int x = 0; x < width; ++x)
+    {
+        dst[0] = table_r[src[0]];
+        dst[1] = table_g[src[1]];
+        dst[2] = table_b[src[2]];
+
+        if (channels == 4)
+            dst[3] = src[3];
+
+        src += channels;
+        dst += channels;
+    }
+}
+
+// pixbufs --------------------------------------------------------------------
+
+typedef struct
+{
+    const uint8_t *src;
+    uint8_t *dst;
+    int src_stride;
+    int dst_stride;
+    unsigned int width;
+    int channels;
+
+    gdColorRow row;         // NULL without matrix
+    gdColorFixed fixed;
+    const gdColorLut *lut;
+
+} gdColorJob;
+
+static void _gd_color_lines(void *data, unsigned int start, unsigned int end)
+{
+    const gdColorJob *job = (const gdColorJob*) data;
+
+    for (unsigned int y = start; y < end; ++y)
+    {
+        const uint8_t *src = job->src + (size_t) y * job->src_stride;
+        uint8_t *dst = job->dst + (size_t) y * job->dst_stride;
+
+        if (job->row)
+        {
+            job->row(&job->fixed, src, dst, job->width, job->channels);
+            src = dst;
+        }
+
+        if (job->lut)
+            _gd_color_lut_row(job->lut, src, dst, job->width, job->channels);
+        else if (src != dst)
+            memcpy(dst, src, (size_t) job->width * job->channels);
+    }
+}
+
+/**
+ * gd_pixbuf_color_filter:
+ * @src: the source pixbuf
+ * @dst: a pixbuf of the same size and layout, may be @src
+ * @mat: the colour matrix or %NULL
+ * @lut: the lookup table applied after @mat or %NULL
+ *
+ * Applies a colour matrix and a lookup table to the rgb channels of @src,
+ * alpha is copied. The rowstrides may differ.
+ *
+ * Returns: 1 on success, 0 on error.
+ **/
+int gd_pixbuf_color_filter(GdkPixbuf *src, GdkPixbuf *dst,
+                           const gdColorMatrix *mat, const gdColorLut *lut)
+{
+    if (src == NULL || dst == NULL
+        || gdk_pixbuf_get_bits_per_sample(src) != 8
+        || gdk_pixbuf_get_bits_per_sample(dst) != 8
+        || gdk_pixbuf_get_width(src) != gdk_pixbuf_get_width(dst)
+        || gdk_pixbuf_get_height(src) != gdk_pixbuf_get_height(dst)
+        || gdk_pixbuf_get_n_channels(src) != gdk_pixbuf_get_n_channels(dst))
+    {
+        return 0;
+    }
+
+    gdColorJob job = {0};
+    job.channels = gdk_pixbuf_get_n_channels(src);
+
+    if (job.channels != 3 && job.channels != 4)
+        return 0;
+
+    job.dst = gdk_pixbuf_get_pixels(dst);
+    job.src = (src == dst) ? job.dst : gdk_pixbuf_get_pixels(src);
+    job.src_stride = gdk_pixbuf_get_rowstride(src);
+    job.dst_stride = gdk_pixbuf_get_rowstride(dst);
+    job.width = gdk_pixbuf_get_width(src);
+    job.lut = lut;
+
+    if (mat)
+    {
+        _gd_color_fixed_init(&job.fixed, mat);
+        job.row = _gd_get_color_row();
+    }
+
+    return gd_run_lines(gdk_pixbuf_get_height(src),
+                        (size_t) job.width * job.channels * 2,
+                        _gd_color_lines, &job);
+}
+
+
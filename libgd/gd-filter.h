@@ -0,0 +1,40 @@
+#ifndef GD_FILTER_H
+#define GD_FILTER_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+// out[i] = m[i][0] * r + m[i][1] * g + m[i][2] * b + m[i][3], the
+// coefficients are in [-8, 8) and the offsets in 0..255 units
+typedef struct
+{
+    float m[3][4];
+
+} gdColorMatrix;
+
+// per channel table applied after the matrix
+typedef struct
+{
+    uint8_t table[3][256];
+
+} gdColorLut;
+
+void gd_color_matrix_identity(gdColorMatrix *mat);
+void gd_color_matrix_multiply(gdColorMatrix *mat,
+                              const gdColorMatrix *a,
+                              const gdColorMatrix *b);
+void gd_color_matrix_saturation(gdColorMatrix *mat, float saturation);
+void gd_color_matrix_brightness_contrast(gdColorMatrix *mat,
+                                         float brightness, float contrast);
+void gd_color_matrix_sepia(gdColorMatrix *mat);
+
+void gd_color_lut_identity(gdColorLut *lut);
+void gd_color_lut_gamma(gdColorLut *lut, float gamma);
+
+int gd_pixbuf_color_filter(GdkPixbuf *src, GdkPixbuf *dst,
+                           const gdColorMatrix *mat, const gdColorLut *lut);
+
+#endif // GD_FILTER_H
+
+
@@ -2,6 +2,7 @@
 #include "gd-image.h"
 
 #include "gd-helpers.h"
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
@@ -21,42 +22,46 @@ gdImage* gd_img_new(int sx, int sy)
     if (overflow2(sizeof(int), sx))
         return NULL;
 
+    // round the row length up to the alignment
+    int align = GD_IMG_ALIGN / sizeof(uint32_t);
+    int stride = (sx + align - 1) / align * align;
+
+    if (overflow2(stride, sy) || overflow2(stride * sy, sizeof(uint32_t)))
+        return NULL;
+
     gdImage* img = (gdImage*) malloc(sizeof(gdImage));
     if (!img)
         return NULL;
 
     memset(img, 0, sizeof(gdImage));
 
+    size_t size = (size_t) stride * sy * sizeof(uint32_t);
+
+    if (posix_memalign((void**) &img->pixels, GD_IMG_ALIGN, size) != 0)
+    {
+        free(img);
+        return NULL;
+    }
+
+    memset(img->pixels, 0, size);
+
     img->tpixels = (uint32_t **) malloc(sizeof(uint32_t*) * sy);
 
     if (!img->tpixels)
     {
+        free(img->pixels);
         free(img);
         return NULL;
     }
 
     for (int i = 0; i < sy; ++i)
-    {
-        img->tpixels[i] = (uint32_t*) calloc(sx, sizeof(uint32_t));
-
-        if (!img->tpixels[i])
-        {
-            i--;
-            while (i >= 0)
-            {
-                free(img->tpixels[i]);
-                i--;
-            }
-            free(img->tpixels);
-            free(img);
-            return NULL;
-        }
-    }
+        img->tpixels[i] = img->pixels + (size_t) i * stride;
 
     assert(img->has_alpha == false);
 
     img->sx = sx;
     img->sy = sy;
+    img->stride = stride;
     img->interpolation_id = GD_BILINEAR_FIXED;
 
     img->cx2 = img->sx - 1;
@@ -113,16 +118,9 @@ gdImage* gd_img_new_from_pixbuf(GdkPixbuf *pixbuf)
 
 void gd_img_free(gdImage* img)
 {
-    if (img->tpixels)
-    {
-        for (int i = 0; (i < img->sy); i++)
-        {
-            free (img->tpixels[i]);
-        }
-        free (img->tpixels);
-    }
-
-    free (img);
+    free(img->tpixels);
+    free(img->pixels);
+    free(img);
 }
 
 
@@ -155,7 +153,6 @@ GdkPixbuf* gd_to_pixbuf(gdImage *img)
                 p[0] = gd_get_red(c);
                 p[1] = gd_get_green(c);
                 p[2] = gd_get_blue(c);
-                p[3] = 255;
             }
         }
 
@@ -186,16 +183,9 @@ gdImage* gd_img_copy(const gdImage *src)
     if (dst == NULL)
         return NULL;
 
-    register int i;
-    register int x;
-
-    for (i = 0; i < src->sy; ++i)
-    {
-        for (x = 0; x < src->sx; ++x)
-        {
-            dst->tpixels[i][x] = src->tpixels[i][x];
-        }
-    }
+    // same size, so same stride
+    memcpy(dst->pixels, src->pixels,
+           (size_t) src->stride * src->sy * sizeof(uint32_t));
 
     dst->has_alpha = src->has_alpha;
 
@@ -9,6 +9,10 @@ typedef double (*interpolation_method) (double, double);
 
 #define gd_img_sx(im) ((im)->sx)
 #define gd_img_sy(im) ((im)->sy)
+#define gd_img_row(im, y) ((im)->pixels + (size_t) (y) * (im)->stride)
+
+// rows start on a 64 bytes boundary, so stride is a multiple of 16 pixels
+#define GD_IMG_ALIGN 64
 #define gd_set_alpha(r, g, b, a) (((r) << 24) + \
                                   ((g) << 16) + \
                                   ((b) <<  8) + \
@@ -92,7 +96,13 @@ typedef enum
 
 typedef struct gdImageStruct
 {
+    // contiguous pixel buffer, rows are stride pixels apart.
+    uint32_t *pixels;
+    int stride;
+
+    // row pointers into pixels.
     uint32_t **tpixels;
+
     bool has_alpha;
     int sx;
     int sy;
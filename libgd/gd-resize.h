@@ -8,6 +8,47 @@ gdImage* gd_img_scale(gdImage *src,
                       unsigned int new_height);
 gdInterpolationMethod gd_img_get_interpolation_method(gdImage *im);
 int gd_img_set_interpolation_method(gdImage *im, gdInterpolationMethod id);
+const char* gd_interpolation_method_get_name(gdInterpolationMethod id);
+int gd_interpolation_method_from_name(const char *name,
+                                      gdInterpolationMethod *id);
+
+typedef enum
+{
+    GD_SCALE_DEFAULT = 0,
+    GD_SCALE_LINEAR_LIGHT = 1 << 0, // filter linear light, not sRGB values
+
+} gdScaleFlags;
+
+GdkPixbuf* gd_pixbuf_scale(GdkPixbuf *src,
+                           unsigned int new_width,
+                           unsigned int new_height,
+                           gdInterpolationMethod method);
+GdkPixbuf* gd_pixbuf_scale_full(GdkPixbuf *src,
+                                unsigned int new_width,
+                                unsigned int new_height,
+                                gdInterpolationMethod method,
+                                gdScaleFlags flags);
+int gd_pixbuf_scale_into(GdkPixbuf *src, GdkPixbuf *dst,
+                         gdInterpolationMethod method, gdScaleFlags flags);
+
+void gd_resize_set_threads(int n_threads);
+int gd_resize_get_threads();
+
+typedef void (*gdLinesFunc)(void *data, unsigned int start, unsigned int end);
+
+int gd_run_lines(unsigned int num_lines, size_t line_size,
+                 gdLinesFunc func, void *data);
+
+typedef enum
+{
+    GD_REDUCE_AUTO,     // box pre-reduction for reductions larger than 4
+    GD_REDUCE_NEVER,
+    GD_REDUCE_ALWAYS,   // box pre-reduction for reductions larger than 2
+
+} gdReduceMode;
+
+void gd_resize_set_reduce_mode(gdReduceMode mode);
+gdReduceMode gd_resize_get_reduce_mode();
 
 #endif // GDRESIZE_H
 
@@ -0,0 +1,551 @@
+#include "config.h"
+#include "gd-rotate.h"
+
+#include "gd-resize.h"
+#include "gd-helpers.h"
+#include <stddef.h>
+#include <string.h>
+
+/*
+    Every orientation is a copy where the source pixel of a destination
+    pixel moves by step_x bytes along a destination row and by step_y
+    bytes from one row to the next.
+
+    Without a quarter turn the rows are copied or reversed. With one the
+    destination is written in GD_ROTATE_TILE square tiles so that the
+    source lines of a tile stay in the cache, four channel tiles are
+    transposed by blocks of 4x4 pixels with SSE2. Rows of tiles run on
+    the scaling thread pool.
+
+    Flips and half turns can be done in place: the rows are reversed or
+    swapped two by two.
+*/
+
+// pixels, a source and a destination tile of four channel pixels take
+// 32 KB
+#define GD_ROTATE_TILE 64
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GD_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef __GNUC__
+#define GD_INLINE inline __attribute__((always_inline))
+#else
+#define GD_INLINE inline
+#endif
+
+typedef struct
+{
+    const uint8_t *src;     // source pixel of the destination origin
+    ptrdiff_t step_x;       // source bytes between destination columns
+    ptrdiff_t step_y;       // source bytes between destination rows
+    uint8_t *dst;
+    int dst_stride;
+    int width;              // destination size
+    int height;
+    int channels;
+    bool simd;
+
+} gdOrientJob;
+
+typedef struct
+{
+    uint8_t *pixels;
+    int stride;
+    int width;
+    int height;
+    int channels;
+    bool swap;              // swaps row y and height - 1 - y
+    bool reverse;           // reverses the rows
+    bool simd;
+
+} gdInPlaceJob;
+
+static int _gd_rotation_get_turns(GdkPixbufRotation angle)
+{
+    switch (angle)
+    {
+    case GDK_PIXBUF_ROTATE_NONE:
+        return 0;
+    case GDK_PIXBUF_ROTATE_CLOCKWISE:
+        return 1;
+    case GDK_PIXBUF_ROTATE_UPSIDEDOWN:
+        return 2;
+    case GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE:
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+static bool _gd_rotate_has_simd()
+{
+    static bool simd = false;
+    static gsize init = 0;
+
+    if (g_once_init_enter(&init))
+    {
+#ifdef GD_SIMD_X86
+        __builtin_cpu_init();
+        simd = __builtin_cpu_supports("sse2");
+#endif
+
+        g_once_init_leave(&init, 1);
+    }
+
+    return simd;
+}
+
+// scalar ---------------------------------------------------------------------
+
+static GD_INLINE void _gd_px_swap(uint8_t *a, uint8_t *b, const int channels)
+{
+    for (int c = 0; c < channels; ++c)
+    {
+        const uint8_t tmp = a[c];
+        a[c] = b[c];
+        b[c] = tmp;
+    }
+}
+
+// dst[i] = src[width - 1 - i], dst isn't src
+static void _gd_row_reverse_c(uint8_t *dst, const uint8_t *src,
+                              int width, int channels)
+{
+    src += (size_t) (width - 1) * channels;
+
+    for (int x = 0; x < width; ++x)
+    {
+        memcpy(dst, src, channels);
+
+        dst += channels;
+        src -= channels;
+    }
+}
+
+// swaps a[i] and b[width - 1 - i], a row with itself when a is b
+static void _gd_rows_swap_reverse_c(uint8_t *a, uint8_t *b,
+                                    int width, int channels)
+{
+    const int count = (a == b) ? width / 2 : width;
+
+    b += (size_t) (width - 1) * channels;
+
+    for (int x = 0; x < count; ++x)
+    {
+        _gd_px_swap(a, b, channels);
+
+        a += channels;
+        b -= channels;
+    }
+}
+
+static void _gd_rows_swap(uint8_t *a, uint8_t *b, size_t size)
+{
+    uint8_t tmp[256];
+
+    while (size > 0)
+    {
+        const size_t n = MIN(size, sizeof(tmp));
+
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+
+        a += n;
+        b += n;
+        size -= n;
+    }
+}
+
+static GD_INLINE void _gd_orient_tile_c(const gdOrientJob *job,
+                                        int x0, int y0, int x1, int y1,
+                                        const int channels)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        const uint8_t *src = job->src + y * job->step_y + x0 * job->step_x;
+        uint8_t *dst = job->dst + (size_t) y * job->dst_stride
+                       + (size_t) x0 * channels;
+
+        for (int x = x0; x < x1; ++x)
+        {
+            memcpy(dst, src, channels);
+
+            src += job->step_x;
+            dst += channels;
+        }
+    }
+}
+
+static void _gd_orient_tile(const gdOrientJob *job,
+                            int x0, int y0, int x1, int y1)
+{
+    // constant channels for the copies
+    if (job->channels == 4)
+        _gd_orient_tile_c(job, x0, y0, x1, y1, 4);
+    else if (job->channels == 3)
+        _gd_orient_tile_c(job, x0, y0, x1, y1, 3);
+    else
+        _gd_orient_tile_c(job, x0, y0, x1, y1, job->channels);
+}
+
+#ifdef GD_SIMD_X86
+
+#define GD_TARGET_SSE2 __attribute__((target("sse2")))
+
+static GD_INLINE GD_TARGET_SSE2 __m128i _gd_px4_reverse_sse2(__m128i v)
+{
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static GD_TARGET_SSE2
+void _gd_row_reverse_sse2(uint8_t *dst, const uint8_t *src, int width)
+{
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4)
+    {
+        const __m128i v = _mm_loadu_si128(
+                            (const __m128i*) (src + (width - 4 - x) * 4));
+
+        _mm_storeu_si128((__m128i*) (dst + x * 4), _gd_px4_reverse_sse2(v));
+    }
+
+    _gd_row_reverse_c(dst + x * 4, src, width - x, 4);
+}
+
+static GD_TARGET_SSE2
+void _gd_rows_swap_reverse_sse2(uint8_t *a, uint8_t *b, int width)
+{
+    // the blocks of a row with itself mustn't overlap
+    const int count = (a == b) ? width / 2 : width;
+    int x = 0;
+
+    for (; x + 4 <= count && (a != b || 2 * x + 8 <= width); x += 4)
+    {
+        uint8_t *pa = a + x * 4;
+        uint8_t *pb = b + (width - 4 - x) * 4;
+
+        const __m128i va = _mm_loadu_si128((const __m128i*) pa);
+        const __m128i vb = _mm_loadu_si128((const __m128i*) pb);
+
+        _mm_storeu_si128((__m128i*) pa, _gd_px4_reverse_sse2(vb));
+        _mm_storeu_si128((__m128i*) pb, _gd_px4_reverse_sse2(va));
+    }
+
+    // the middle of the rows
+    if (a == b)
+        _gd_rows_swap_reverse_c(a + x * 4, a + x * 4, width - 2 * x, 4);
+    else
+        for (; x < width; ++x)
+            _gd_px_swap(a + x * 4, b + (width - 1 - x) * 4, 4);
+}
+
+// step_y is 4 or -4 bytes
+static GD_TARGET_SSE2
+void _gd_orient_tile_sse2(const gdOrientJob *job,
+                          int x0, int y0, int x1, int y1)
+{
+    const ptrdiff_t step_x = job->step_x;
+    const ptrdiff_t step_y = job->step_y;
+    const bool reversed = (step_y < 0);
+
+    // lowest address of the four pixels of a block column
+    const ptrdiff_t low = reversed ? 3 * step_y : 0;
+
+    int y = y0;
+
+    for (; y + 4 <= y1; y += 4)
+    {
+        uint8_t *dst = job->dst + (size_t) y * job->dst_stride;
+        int x = x0;
+
+        for (; x + 4 <= x1; x += 4)
+        {
+            const uint8_t *src = job->src + y * step_y + x * step_x + low;
+            __m128i v[4];
+
+            // the destination column x + i
+            for (int i = 0; i < 4; ++i)
+            {
+                v[i] = _mm_loadu_si128(
+                                (const __m128i*) (src + i * step_x));
+
+                if (reversed)
+                    v[i] = _gd_px4_reverse_sse2(v[i]);
+            }
+
+            const __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+            const __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+            const __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+            const __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+
+            uint8_t *out = dst + x * 4;
+            const int stride = job->dst_stride;
+
+            _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128((__m128i*) (out + stride),
+                             _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128((__m128i*) (out + 2 * stride),
+                             _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128((__m128i*) (out + 3 * stride),
+                             _mm_unpackhi_epi64(t2, t3));
+        }
+
+        if (x < x1)
+            _gd_orient_tile_c(job, x, y, x1, y + 4, 4);
+    }
+
+    if (y < y1)
+        _gd_orient_tile_c(job, x0, y, x1, y1, 4);
+}
+
+#endif // GD_SIMD_X86
+
+// lines ----------------------------------------------------------------------
+
+static void _gd_orient_rows(void *data, unsigned int start, unsigned int end)
+{
+    const gdOrientJob *job = (const gdOrientJob*) data;
+    const size_t size = (size_t) job->width * job->channels;
+
+    for (unsigned int y = start; y < end; ++y)
+    {
+        const uint8_t *src = job->src + (ptrdiff_t) y * job->step_y;
+        uint8_t *dst = job->dst + (size_t) y * job->dst_stride;
+
+        if (job->step_x > 0)
+        {
+            memcpy(dst, src, size);
+            continue;
+        }
+
+        // src is the last pixel of the row
+        src -= size - job->channels;
+
+#ifdef GD_SIMD_X86
+        if (job->simd && job->channels == 4)
+        {
+            _gd_row_reverse_sse2(dst, src, job->width);
+            continue;
+        }
+#endif
+
+        _gd_row_reverse_c(dst, src, job->width, job->channels);
+    }
+}
+
+static void _gd_orient_tiles(void *data, unsigned int start, unsigned int end)
+{
+    const gdOrientJob *job = (const gdOrientJob*) data;
+
+    for (unsigned int row = start; row < end; ++row)
+    {
+        const int y0 = row * GD_ROTATE_TILE;
+        const int y1 = MIN(y0 + GD_ROTATE_TILE, job->height);
+
+        for (int x0 = 0; x0 < job->width; x0 += GD_ROTATE_TILE)
+        {
+            const int x1 = MIN(x0 + GD_ROTATE_TILE, job->width);
+
+#ifdef GD_SIMD_X86
+            if (job->simd && job->channels == 4)
+            {
+                _gd_orient_tile_sse2(job, x0, y0, x1, y1);
+                continue;
+            }
+#endif
+
+            _gd_orient_tile(job, x0, y0, x1, y1);
+        }
+    }
+}
+
+static void _gd_in_place_lines(void *data,
+                               unsigned int start, unsigned int end)
+{
+    const gdInPlaceJob *job = (const gdInPlaceJob*) data;
+
+    for (unsigned int y = start; y < end; ++y)
+    {
+        uint8_t *a = job->pixels + (size_t) y * job->stride;
+        uint8_t *b = job->swap
+                        ? job->pixels
+                          + (size_t) (job->height - 1 - y) * job->stride
+                        : a;
+
+        if (!job->reverse)
+        {
+            _gd_rows_swap(a, b, (size_t) job->width * job->channels);
+            continue;
+        }
+
+#ifdef GD_SIMD_X86
+        if (job->simd && job->channels == 4)
+        {
+            _gd_rows_swap_reverse_sse2(a, b, job->width);
+            continue;
+        }
+#endif
+
+        _gd_rows_swap_reverse_c(a, b, job->width, job->channels);
+    }
+}
+
+// pixbufs --------------------------------------------------------------------
+
+/**
+ * gd_pixbuf_rotate_flip:
+ * @src: the source pixbuf
+ * @angle: the rotation
+ * @flip: flips @src horizontally before the rotation
+ * @returns: a new pixbuf or %NULL.
+ *
+ * Cache blocked and threaded variant of gdk_pixbuf_rotate_simple() and
+ * gdk_pixbuf_flip(), both done in one copy.
+ **/
+GdkPixbuf* gd_pixbuf_rotate_flip(GdkPixbuf *src,
+                                 GdkPixbufRotation angle, bool flip)
+{
+    const int turns = _gd_rotation_get_turns(angle);
+
+    if (src == NULL || turns < 0
+        || gdk_pixbuf_get_bits_per_sample(src) != 8)
+    {
+        return NULL;
+    }
+
+    const int width = gdk_pixbuf_get_width(src);
+    const int height = gdk_pixbuf_get_height(src);
+    const int channels = gdk_pixbuf_get_n_channels(src);
+    const ptrdiff_t stride = gdk_pixbuf_get_rowstride(src);
+
+    GdkPixbuf *dst = gdk_pixbuf_new(gdk_pixbuf_get_colorspace(src),
+                                    gdk_pixbuf_get_has_alpha(src), 8,
+                                    (turns % 2) ? height : width,
+                                    (turns % 2) ? width : height);
+    if (dst == NULL)
+        return NULL;
+
+    gdOrientJob job = {0};
+    job.dst = gdk_pixbuf_get_pixels(dst);
+    job.dst_stride = gdk_pixbuf_get_rowstride(dst);
+    job.width = gdk_pixbuf_get_width(dst);
+    job.height = gdk_pixbuf_get_height(dst);
+    job.channels = channels;
+    job.simd = _gd_rotate_has_simd();
+
+    // source pixel (u, v) of the flipped source, and its step along u
+    const uint8_t *pixels = gdk_pixbuf_read_pixels(src);
+    const ptrdiff_t step_u = flip ? -channels : channels;
+    const uint8_t *corner[4] =
+    {
+        pixels + (flip ? (ptrdiff_t) (width - 1) * channels : 0),
+        pixels + (flip ? 0 : (ptrdiff_t) (width - 1) * channels),
+        pixels + (ptrdiff_t) (height - 1) * stride
+               + (flip ? 0 : (ptrdiff_t) (width - 1) * channels),
+        pixels + (ptrdiff_t) (height - 1) * stride
+               + (flip ? (ptrdiff_t) (width - 1) * channels : 0),
+    };
+
+    // corners (0, 0), (w - 1, 0), (w - 1, h - 1), (0, h - 1) of the
+    // flipped source land on the destination origin after each turn
+    switch (turns)
+    {
+    case 0:
+        job.src = corner[0];
+        job.step_x = step_u;
+        job.step_y = stride;
+        break;
+    case 1:
+        job.src = corner[3];
+        job.step_x = -stride;
+        job.step_y = step_u;
+        break;
+    case 2:
+        job.src = corner[2];
+        job.step_x = -step_u;
+        job.step_y = -stride;
+        break;
+    case 3:
+        job.src = corner[1];
+        job.step_x = stride;
+        job.step_y = -step_u;
+        break;
+    }
+
+    int ret;
+
+    if (turns % 2)
+    {
+        const size_t line_size = (size_t) GD_ROTATE_TILE * job.width
+                                 * channels * 2;
+
+        ret = gd_run_lines((job.height + GD_ROTATE_TILE - 1) / GD_ROTATE_TILE,
+                           line_size, _gd_orient_tiles, &job);
+    }
+    else
+    {
+        ret = gd_run_lines(job.height, (size_t) job.width * channels * 2,
+                           _gd_orient_rows, &job);
+    }
+
+    if (!ret)
+        g_clear_object(&dst);
+
+    return dst;
+}
+
+/**
+ * gd_pixbuf_rotate_flip_in_place:
+ * @pixbuf: the pixbuf to transform
+ * @angle: the rotation, %GDK_PIXBUF_ROTATE_NONE or
+ *         %GDK_PIXBUF_ROTATE_UPSIDEDOWN
+ * @flip: flips @pixbuf horizontally before the rotation
+ *
+ * Variant of gd_pixbuf_rotate_flip() for the transforms that keep the
+ * size, without a second buffer.
+ *
+ * Returns: 1 on success, 0 on error.
+ **/
+int gd_pixbuf_rotate_flip_in_place(GdkPixbuf *pixbuf,
+                                   GdkPixbufRotation angle, bool flip)
+{
+    const int turns = _gd_rotation_get_turns(angle);
+
+    if (pixbuf == NULL || turns < 0 || (turns % 2)
+        || gdk_pixbuf_get_bits_per_sample(pixbuf) != 8)
+    {
+        return 0;
+    }
+
+    if (turns == 0 && !flip)
+        return 1;
+
+    gdInPlaceJob job = {0};
+    job.pixels = gdk_pixbuf_get_pixels(pixbuf);
+    job.stride = gdk_pixbuf_get_rowstride(pixbuf);
+    job.width = gdk_pixbuf_get_width(pixbuf);
+    job.height = gdk_pixbuf_get_height(pixbuf);
+    job.channels = gdk_pixbuf_get_n_channels(pixbuf);
+    job.simd = _gd_rotate_has_simd();
+
+    // a horizontal flip and a half turn make a vertical flip
+    job.swap = (turns == 2);
+    job.reverse = (turns == 2) != flip;
+
+    unsigned int num_lines = job.height;
+
+    // the rows are swapped by pairs, the middle one is reversed alone
+    if (job.swap)
+        num_lines = job.reverse ? (job.height + 1) / 2 : job.height / 2;
+
+    return gd_run_lines(num_lines,
+                        (size_t) job.width * job.channels * 2,
+                        _gd_in_place_lines, &job);
+}
+
+
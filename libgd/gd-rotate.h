@@ -0,0 +1,16 @@
+#ifndef GD_ROTATE_H
+#define GD_ROTATE_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <stdbool.h>
+
+// flip is a horizontal flip done before the rotation, a vertical flip is
+// a horizontal one with GDK_PIXBUF_ROTATE_UPSIDEDOWN
+GdkPixbuf* gd_pixbuf_rotate_flip(GdkPixbuf *src,
+                                 GdkPixbufRotation angle, bool flip);
+int gd_pixbuf_rotate_flip_in_place(GdkPixbuf *pixbuf,
+                                   GdkPixbufRotation angle, bool flip);
+
+#endif // GD_ROTATE_H
+
+
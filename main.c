@@ -24,6 +24,8 @@
 #include "list.h"
 #include "uni-utils.h"
 #include "vnr-tools.h"
+#include "vnr-batch.h"
+#include "uni-exiv2.hpp"
 
 #define PIXMAP_DIR PACKAGE_DATA_DIR "/imgview/pixmaps/"
 
@@ -31,6 +33,9 @@ static gchar **opt_files;
 static gboolean opt_version;
 static gboolean opt_slideshow;
 static gboolean opt_fullscreen;
+static gchar *opt_batch_resize;
+static gchar *opt_filter;
+static gchar *opt_out;
 
 static GOptionEntry opt_entries[] =
 {
@@ -39,9 +44,27 @@ static GOptionEntry opt_entries[] =
     {"version", 0, 0, G_OPTION_ARG_NONE, &opt_version, NULL, NULL},
     {"slideshow", 0, 0, G_OPTION_ARG_NONE, &opt_slideshow, NULL, NULL},
     {"fullscreen", 0, 0, G_OPTION_ARG_NONE, &opt_fullscreen, NULL, NULL},
+    {"batch-resize", 0, 0, G_OPTION_ARG_STRING, &opt_batch_resize,
+     "Resize the files to fit in a box, without a window", "WxH"},
+    {"filter", 0, 0, G_OPTION_ARG_STRING, &opt_filter,
+     "Filter of the batch resize, lanczos3 by default", "NAME"},
+    {"out", 0, 0, G_OPTION_ARG_FILENAME, &opt_out,
+     "Directory of the resized files", "DIR"},
     {NULL}
 };
 
+static gboolean _main_is_batch(int argc, char **argv)
+{
+    // the GTK options would open the display while parsing
+    for (int i = 1; i < argc; ++i)
+    {
+        if (g_str_has_prefix(argv[i], "--batch-resize"))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
 int main(int argc, char **argv)
 {
     setbuf(stdout, NULL);
@@ -53,7 +76,9 @@ int main(int argc, char **argv)
     GOptionContext *opt_context =
             g_option_context_new("- Elegant Image Viewer");
     g_option_context_add_main_entries(opt_context, opt_entries, NULL);
-    g_option_context_add_group(opt_context, gtk_get_option_group(TRUE));
+
+    if (!_main_is_batch(argc, argv))
+        g_option_context_add_group(opt_context, gtk_get_option_group(TRUE));
 
     GError *error = NULL;
     g_option_context_parse(opt_context, &argc, &argv, &error);
@@ -75,6 +100,13 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    // before the threads that read metadata
+    uni_exiv2_init();
+
+    if (opt_batch_resize)
+        return vnr_batch_resize(opt_files, opt_batch_resize,
+                                opt_filter, opt_out);
+
     gtk_icon_theme_append_search_path(gtk_icon_theme_get_default(),
                                       PIXMAP_DIR);
 
@@ -168,6 +168,60 @@ void uni_cache_invalidate(UniDrawCache *cache)
     cache->old.zoom = -1234.0;
 }
 
+/**
+ * uni_cache_damage:
+ * @cache: a #UniDrawCache
+ * @area: the modified area in zoom space coordinates
+ *
+ * Scales again the part of the cached area intersecting @area, after
+ * the pixels of the source pixbuf were modified in place. Unlike
+ * uni_cache_invalidate(), the rest of the cache stays valid.
+ **/
+void uni_cache_damage(UniDrawCache *cache, GdkRectangle *area)
+{
+    UniDrawOpts *old = &cache->old;
+
+    // nothing cached yet or already invalidated
+    if (old->zoom <= 0)
+        return;
+
+    GdkRectangle inter;
+    if (!gdk_rectangle_intersect(&old->zoom_rect, area, &inter))
+        return;
+
+    uni_pixbuf_scale_blend(old->pixbuf,
+                           cache->last_pixbuf,
+                           inter.x - old->zoom_rect.x,
+                           inter.y - old->zoom_rect.y,
+                           inter.width, inter.height,
+                           -old->zoom_rect.x, -old->zoom_rect.y,
+                           old->zoom,
+                           old->interp, inter.x, inter.y);
+}
+
+/**
+ * uni_cache_adopt:
+ * @cache: a #UniDrawCache
+ * @opts: the draw options @scaled was rendered with
+ * @scaled: a pixbuf containing the @opts->zoom_rect area
+ *
+ * Replaces the cache contents with an area scaled beforehand, for
+ * example by a background thread, so that the next draws using the same
+ * pixbuf and zoom only need to copy it.
+ **/
+void uni_cache_adopt(UniDrawCache *cache, UniDrawOpts *opts,
+                     GdkPixbuf *scaled)
+{
+    g_return_if_fail(gdk_pixbuf_get_width(scaled) >= opts->zoom_rect.width);
+    g_return_if_fail(gdk_pixbuf_get_height(scaled)
+                     >= opts->zoom_rect.height);
+
+    g_object_unref(cache->last_pixbuf);
+    cache->last_pixbuf = g_object_ref(scaled);
+
+    cache->old = *opts;
+}
+
 static GdkPixbuf* uni_cache_scroll_intersection(GdkPixbuf *pixbuf,
                                                             int new_width,
                                                             int new_height,
@@ -294,14 +348,20 @@ void uni_cache_draw(UniDrawCache *cache, UniDrawOpts *opts, cairo_t *cr)
         int new_bps = gdk_pixbuf_get_bits_per_sample(opts->pixbuf);
         int last_bps = gdk_pixbuf_get_bits_per_sample(cache->last_pixbuf);
 
+        // images with alpha are scaled as RGBA into the cache and then
+        // blended in place over the checkerboard.
+        gboolean new_alpha = gdk_pixbuf_get_has_alpha(opts->pixbuf);
+        gboolean last_alpha = gdk_pixbuf_get_has_alpha(cache->last_pixbuf);
+
         if (this.width > last_width
             || this.height > last_height
             || new_cs != last_cs
-            || new_bps != last_bps)
+            || new_bps != last_bps
+            || new_alpha != last_alpha)
         {
             g_object_unref(cache->last_pixbuf);
 
-            cache->last_pixbuf = gdk_pixbuf_new(new_cs, FALSE, new_bps,
+            cache->last_pixbuf = gdk_pixbuf_new(new_cs, new_alpha, new_bps,
                                                 this.width, this.height);
         }
 
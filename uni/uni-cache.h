@@ -86,7 +86,10 @@ struct _UniDrawCache
 UniDrawCache *uni_cache_new();
 void uni_cache_free(UniDrawCache *cache);
 void uni_cache_invalidate(UniDrawCache *cache);
+void uni_cache_damage(UniDrawCache *cache, GdkRectangle *area);
 void uni_cache_draw(UniDrawCache *cache, UniDrawOpts *opts, cairo_t *cr);
+void uni_cache_adopt(UniDrawCache *cache, UniDrawOpts *opts,
+                     GdkPixbuf *scaled);
 
 UniDrawMethod uni_cache_get_method(UniDrawOpts *old_opts,
                                    UniDrawOpts *new_opts);
@@ -201,17 +201,11 @@ gboolean uni_dragger_motion_notify(UniDragger *dragger, GdkEventMotion *event)
         return TRUE;
     }
 
-    GdkRectangle viewport;
-
-    uni_image_view_get_viewport(UNI_IMAGE_VIEW(dragger->view), &viewport);
-
-    int offset_x = viewport.x + dx;
-    int offset_y = viewport.y + dy;
-
-    // move image...
-    uni_image_view_set_offset(UNI_IMAGE_VIEW(dragger->view),
-                              offset_x, offset_y,
-                              uni_is_wayland());
+    // move image on the next frame, motion events received meanwhile
+    // are merged into a single scroll.
+    uni_image_view_queue_offset(UNI_IMAGE_VIEW(dragger->view),
+                                dx, dy,
+                                uni_is_wayland());
 
     dragger->drag_base_x = dragger->drag_ofs_x;
     dragger->drag_base_y = dragger->drag_ofs_y;
@@ -232,9 +226,11 @@ void uni_dragger_pixbuf_changed(UniDragger *dragger, gboolean reset_fit,
                                 GdkRectangle *rect)
 {
     (void) reset_fit;
-    (void) rect;
 
-    uni_cache_invalidate(dragger->cache);
+    if (rect)
+        uni_cache_damage(dragger->cache, rect);
+    else
+        uni_cache_invalidate(dragger->cache);
 }
 
 void uni_dragger_paint_image(UniDragger *dragger, UniDrawOpts *opts,
@@ -243,4 +239,10 @@ void uni_dragger_paint_image(UniDragger *dragger, UniDrawOpts *opts,
     uni_cache_draw(dragger->cache, opts, cr);
 }
 
+void uni_dragger_adopt_image(UniDragger *dragger, UniDrawOpts *opts,
+                             GdkPixbuf *scaled)
+{
+    uni_cache_adopt(dragger->cache, opts, scaled);
+}
+
 
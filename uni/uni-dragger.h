@@ -69,6 +69,8 @@ void uni_dragger_pixbuf_changed(UniDragger *dragger, gboolean reset_fit,
                                 GdkRectangle *rect);
 void uni_dragger_paint_image(UniDragger *dragger, UniDrawOpts *opts,
                              cairo_t *cr);
+void uni_dragger_adopt_image(UniDragger *dragger, UniDrawOpts *opts,
+                             GdkPixbuf *scaled);
 
 G_END_DECLS
 
@@ -36,7 +36,13 @@
 #endif
 #endif
 
-static std::unique_ptr<Exiv2::Image> cached_image;
+// Exiv2 is not thread safe until the XMP toolkit is initialized, call it
+// once before reading metadata in a thread
+extern "C" void uni_exiv2_init()
+{
+    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
+    Exiv2::XmpParser::initialize();
+}
 
 extern "C" void uni_read_exiv2_map(const char *uri,
                                    void (*callback) (const char *,
@@ -44,7 +50,6 @@ extern "C" void uni_read_exiv2_map(const char *uri,
                                                      void *),
                                    void *user_data)
 {
-    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
     try
     {
         std::unique_ptr<Exiv2::Image> image = Exiv2::ImageFactory::open(uri);
@@ -110,56 +115,83 @@ extern "C" void uni_read_exiv2_map(const char *uri,
     }
 }
 
-extern "C" int uni_read_exiv2_to_cache(const char *uri)
+// the Exif orientation, 1 if the file has none
+extern "C" int uni_read_exiv2_orientation(const char *uri)
 {
-    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
-
-    if (cached_image != nullptr)
-    {
-        cached_image->clearMetadata();
-        cached_image.reset(nullptr);
-    }
-
     try
     {
-        cached_image = Exiv2::ImageFactory::open(uri);
-        if (cached_image == nullptr)
+        std::unique_ptr<Exiv2::Image> image = Exiv2::ImageFactory::open(uri);
+        if (image == nullptr)
         {
             return 1;
         }
 
-        cached_image->readMetadata();
+        image->readMetadata();
+        Exiv2::ExifData &exifData = image->exifData();
+
+        Exiv2::ExifData::const_iterator pos = Exiv2::orientation(exifData);
+
+        // toLong() is toInt64() since 0.28, toFloat() is in both
+        if (pos != exifData.end() && pos->count() > 0)
+        {
+            int orientation = (int) pos->toFloat();
+
+            if (orientation >= 1 && orientation <= 8)
+            {
+                return orientation;
+            }
+        }
     }
     catch (EXIV_ERROR &e)
     {
         std::cerr << "Exiv2: '" << e << "'\n";
     }
 
-    return 0;
+    return 1;
 }
 
-extern "C" int uni_write_exiv2_from_cache(const char *uri)
+// merges the metadata in the file in memory, without writing it again
+extern "C" int uni_copy_exiv2_to_buffer(const char *src_uri,
+                                        char **buffer, size_t *size)
 {
-    Exiv2::LogMsg::setLevel(Exiv2::LogMsg::mute);
-
-    if (cached_image == nullptr)
-    {
-        return 1;
-    }
-
     try
     {
-        std::unique_ptr<Exiv2::Image> image = Exiv2::ImageFactory::open(uri);
-        if (image == nullptr)
+        std::unique_ptr<Exiv2::Image> src = Exiv2::ImageFactory::open(src_uri);
+        if (src == nullptr)
+        {
+            return 1;
+        }
+
+        src->readMetadata();
+
+        // the image is opened on a copy of the buffer, in a MemIo
+        std::unique_ptr<Exiv2::Image> dest = Exiv2::ImageFactory::open(
+                            reinterpret_cast<const Exiv2::byte*>(*buffer),
+                            *size);
+        if (dest == nullptr)
         {
             return 2;
         }
 
-        image->setMetadata(*cached_image);
-        image->writeMetadata();
+        dest->setMetadata(*src);
+        dest->writeMetadata();
+
+        Exiv2::BasicIo &io = dest->io();
+        size_t length = io.size();
+
+        char *data = (char*) g_malloc(length);
+
+        io.seek(0, Exiv2::BasicIo::beg);
+        if ((size_t) io.read(reinterpret_cast<Exiv2::byte*>(data), length)
+            != length)
+        {
+            g_free(data);
+            return 3;
+        }
 
-        cached_image->clearMetadata();
-        cached_image.reset(nullptr);
+        g_free(*buffer);
+        *buffer = data;
+        *size = length;
 
         return 0;
     }
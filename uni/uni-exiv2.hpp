@@ -70,13 +70,16 @@ extern "C"
 
 #endif
 
+    void uni_exiv2_init();
     void uni_read_exiv2_map(
                     const char *uri,
                     void (*callback) (const char *, const char *, void *),
                     void *user_data);
 
-    int uni_read_exiv2_to_cache(const char *uri);
-    int uni_write_exiv2_from_cache(const char *uri);
+    int uni_read_exiv2_orientation(const char *uri);
+
+    int uni_copy_exiv2_to_buffer(const char *src_uri,
+                                 char **buffer, size_t *size);
 
 #ifdef __cplusplus
 }
@@ -34,6 +34,9 @@
 #define UNI_ZOOM_MAX    20.0
 #define UNI_ZOOM_STEP   1.1
 
+// above this count, damaged rectangles are merged into their extents
+#define UNI_MAX_DAMAGE_RECTS 16
+
 // clang-format off
 #define g_signal_handlers_disconnect_by_data(instance, data) \
     g_signal_handlers_disconnect_matched ((instance), G_SIGNAL_MATCH_DATA, \
@@ -57,6 +60,9 @@ static void uni_image_view_set_property(GObject *object,
                                         GParamSpec *pspec);
 static void uni_image_view_realize(GtkWidget *widget);
 static void uni_image_view_unrealize(GtkWidget *widget);
+static void uni_image_view_style_updated(GtkWidget *widget);
+static void uni_image_view_state_flags_changed(GtkWidget *widget,
+                                               GtkStateFlags previous);
 static void uni_image_view_finalize(GObject *object);
 
 static void widget_size_allocate(GtkWidget *widget, GtkAllocation *alloc);
@@ -94,6 +100,7 @@ static void _uni_image_view_zoom_to_fit(UniImageView *view,
 
 static void _uni_image_view_draw_background(UniImageView *view,
                                            GdkRectangle *image_area,
+                                           GdkRectangle *paint_rect,
                                            Size alloc,
                                            cairo_t *cr);
 static int _uni_image_view_repaint_area(UniImageView *view,
@@ -107,6 +114,11 @@ static void _uni_image_view_scroll_to(UniImageView *view,
                                      gdouble offset_y,
                                      gboolean set_adjustments,
                                      gboolean invalidate);
+static gboolean _uni_image_view_on_tick(GtkWidget *widget,
+                                        GdkFrameClock *clock,
+                                        gpointer data);
+static void _uni_image_view_clear_prerender(UniImageView *view);
+static void _uni_image_view_adopt_prerender(UniImageView *view);
 
 static gboolean _on_hadj_value_changed(UniImageView *view,
                                                 GtkAdjustment *adj);
@@ -147,6 +159,22 @@ struct _UniImageViewPrivate
     // driving the scrollable adjustment values
     GtkScrollablePolicy hscroll_policy : 1;
     GtkScrollablePolicy vscroll_policy : 1;
+
+    // Offset deltas accumulated between two frame clock ticks.
+    gdouble pending_dx;
+    gdouble pending_dy;
+    gboolean pending_invalidate;
+    guint tick_id;
+
+    // Scaled image rendered ahead of time, see uni_image_view_set_prerender
+    GdkPixbuf *prerender_src;
+    GdkPixbuf *prerender;
+    gdouble prerender_zoom;
+    GdkInterpType prerender_interp;
+
+    // Background color, queried from the style context when invalid.
+    GdkRGBA bg_color;
+    gboolean bg_valid;
 };
 
 static guint uni_image_view_signals[LAST_SIGNAL] = {0};
@@ -175,6 +203,8 @@ static void uni_image_view_class_init(UniImageViewClass *klass)
     GtkWidgetClass *widget_class = (GtkWidgetClass *)klass;
     widget_class->realize = uni_image_view_realize;
     widget_class->unrealize = uni_image_view_unrealize;
+    widget_class->style_updated = uni_image_view_style_updated;
+    widget_class->state_flags_changed = uni_image_view_state_flags_changed;
 
     widget_class->size_allocate = widget_size_allocate;
     widget_class->draw = widget_draw;
@@ -390,6 +420,13 @@ static void uni_image_view_init(UniImageView *view)
                                                 UNI_TYPE_IMAGE_VIEW);
 
     view->priv->hadjustment = view->priv->vadjustment = NULL;
+    view->priv->pending_dx = 0.0;
+    view->priv->pending_dy = 0.0;
+    view->priv->pending_invalidate = FALSE;
+    view->priv->tick_id = 0;
+    view->priv->prerender_src = NULL;
+    view->priv->prerender = NULL;
+    view->priv->bg_valid = FALSE;
     uni_image_view_set_scroll_adjustments(
                             view,
                             GTK_ADJUSTMENT(gtk_adjustment_new(0.0,
@@ -523,11 +560,36 @@ static void uni_image_view_unrealize(GtkWidget *widget)
 {
     UniImageView *view = UNI_IMAGE_VIEW(widget);
 
+    if (view->priv->tick_id)
+    {
+        gtk_widget_remove_tick_callback(widget, view->priv->tick_id);
+        view->priv->tick_id = 0;
+    }
+
+    view->priv->pending_dx = 0.0;
+    view->priv->pending_dy = 0.0;
+
     g_object_unref(view->void_cursor);
 
     GTK_WIDGET_CLASS(uni_image_view_parent_class)->unrealize(widget);
 }
 
+static void uni_image_view_style_updated(GtkWidget *widget)
+{
+    UNI_IMAGE_VIEW(widget)->priv->bg_valid = FALSE;
+
+    GTK_WIDGET_CLASS(uni_image_view_parent_class)->style_updated(widget);
+}
+
+static void uni_image_view_state_flags_changed(GtkWidget *widget,
+                                               GtkStateFlags previous)
+{
+    UNI_IMAGE_VIEW(widget)->priv->bg_valid = FALSE;
+
+    GTK_WIDGET_CLASS(uni_image_view_parent_class)->state_flags_changed(
+                                                        widget, previous);
+}
+
 static void uni_image_view_finalize(GObject *object)
 {
     UniImageView *view = UNI_IMAGE_VIEW(object);
@@ -550,6 +612,7 @@ static void uni_image_view_finalize(GObject *object)
         g_object_unref(view->pixbuf);
         view->pixbuf = NULL;
     }
+    _uni_image_view_clear_prerender(view);
     g_object_unref(view->dragger);
     // Chain up.
     G_OBJECT_CLASS(uni_image_view_parent_class)->finalize(object);
@@ -655,15 +718,12 @@ static void _uni_image_view_zoom_to_fit(UniImageView *view,
     gtk_widget_get_allocation(scrollwin, &allocation);
 
     Size imgsize = _uni_image_view_get_pixbuf_size(view);
-    gdouble ratio_x = (gdouble) allocation.width / imgsize.width;
-    gdouble ratio_y = (gdouble) allocation.height / imgsize.height;
 
-    gdouble zoom = MIN(ratio_y, ratio_x);
-
-    if (view->fitting == UNI_FITTING_NORMAL)
-        zoom = CLAMP(zoom, UNI_ZOOM_MIN, 1.0);
-    else if (view->fitting == UNI_FITTING_FULL)
-        zoom = CLAMP(zoom, UNI_ZOOM_MIN, UNI_ZOOM_MAX);
+    gdouble zoom = uni_image_view_get_fit_zoom(view->fitting,
+                                               allocation.width,
+                                               allocation.height,
+                                               imgsize.width,
+                                               imgsize.height);
 
     _uni_image_view_set_zoom_no_center(view, zoom, is_allocating);
 }
@@ -756,6 +816,8 @@ static Size _uni_image_view_get_zoomed_size(UniImageView *view)
 
 static int widget_draw(GtkWidget *widget, cairo_t *cr)
 {
+    _uni_image_view_adopt_prerender(UNI_IMAGE_VIEW(widget));
+
     GtkWidget *scrollwin = _uni_get_scrollwin(widget);
 
     GtkAllocation allocation;
@@ -764,8 +826,50 @@ static int widget_draw(GtkWidget *widget, cairo_t *cr)
     allocation.x = 0;
     allocation.y = 0;
 
-    return _uni_image_view_repaint_area(UNI_IMAGE_VIEW(widget),
-                                        &allocation, cr);
+    // only copy the damaged rectangles from the draw cache, falling back
+    // to the clip extents if there are too many of them or the clip isn't
+    // representable as a list of rectangles.
+    cairo_rectangle_list_t *list = cairo_copy_clip_rectangle_list(cr);
+
+    if (list->status != CAIRO_STATUS_SUCCESS
+        || list->num_rectangles > UNI_MAX_DAMAGE_RECTS)
+    {
+        cairo_rectangle_list_destroy(list);
+
+        GdkRectangle extents;
+        if (!gdk_cairo_get_clip_rectangle(cr, &extents))
+            return FALSE;
+
+        GdkRectangle paint_rect;
+        if (!gdk_rectangle_intersect(&allocation, &extents, &paint_rect))
+            return FALSE;
+
+        return _uni_image_view_repaint_area(UNI_IMAGE_VIEW(widget),
+                                            &paint_rect, cr);
+    }
+
+    for (int i = 0; i < list->num_rectangles; ++i)
+    {
+        cairo_rectangle_t *r = &list->rectangles[i];
+
+        int x1 = floor(r->x);
+        int y1 = floor(r->y);
+        int x2 = ceil(r->x + r->width);
+        int y2 = ceil(r->y + r->height);
+
+        GdkRectangle damaged = {x1, y1, x2 - x1, y2 - y1};
+        GdkRectangle paint_rect;
+
+        if (gdk_rectangle_intersect(&allocation, &damaged, &paint_rect))
+        {
+            _uni_image_view_repaint_area(UNI_IMAGE_VIEW(widget),
+                                         &paint_rect, cr);
+        }
+    }
+
+    cairo_rectangle_list_destroy(list);
+
+    return TRUE;
 }
 
 static int _uni_image_view_repaint_area(UniImageView *view,
@@ -794,7 +898,8 @@ static int _uni_image_view_repaint_area(UniImageView *view,
         || image_area.width < alloc.width
         || image_area.height < alloc.height)
     {
-        _uni_image_view_draw_background(view, &image_area, alloc, cr);
+        _uni_image_view_draw_background(view, &image_area, paint_rect,
+                                        alloc, cr);
     }
 
     // paint area is the area on the widget that should be redrawn
@@ -804,26 +909,28 @@ static int _uni_image_view_repaint_area(UniImageView *view,
                                                   &paint_area);
     if (intersects && view->pixbuf)
     {
-        int src_x = (int) ((view->offset_x
-                            + (gdouble) paint_area.x
-                            - (gdouble) image_area.x) + 0.5);
-        int src_y = (int) ((view->offset_y
-                            + (gdouble) paint_area.y
-                            - (gdouble) image_area.y) + 0.5);
-
+        // the draw cache always holds the whole visible image, so the
+        // damaged rectangles of a draw are copied from it and only the
+        // copy is clipped to the paint area.
         UniDrawOpts opts;
 
         opts.zoom = view->zoom;
-        opts.zoom_rect.x = src_x;
-        opts.zoom_rect.y = src_y;
-        opts.zoom_rect.width = paint_area.width;
-        opts.zoom_rect.height = paint_area.height;
-        opts.widget_x = paint_area.x;
-        opts.widget_y = paint_area.y;
+        opts.zoom_rect.x = (int) (view->offset_x + 0.5);
+        opts.zoom_rect.y = (int) (view->offset_y + 0.5);
+        opts.zoom_rect.width = image_area.width;
+        opts.zoom_rect.height = image_area.height;
+        opts.widget_x = image_area.x;
+        opts.widget_y = image_area.y;
         opts.interp = view->interp;
         opts.pixbuf = view->pixbuf;
 
+        cairo_save(cr);
+        gdk_cairo_rectangle(cr, &paint_area);
+        cairo_clip(cr);
+
         uni_dragger_paint_image(UNI_DRAGGER(view->dragger), &opts, cr);
+
+        cairo_restore(cr);
     }
 
     view->is_rendering = FALSE;
@@ -833,22 +940,29 @@ static int _uni_image_view_repaint_area(UniImageView *view,
 
 static void _uni_image_view_draw_background(UniImageView *view,
                                             GdkRectangle *image_area,
+                                            GdkRectangle *paint_rect,
                                             Size alloc,
                                             cairo_t *cr)
 {
-    cairo_save(cr);
+    UniImageViewPrivate *priv = view->priv;
 
-    GtkWidget *widget = GTK_WIDGET(view);
-    GtkStyleContext *context = gtk_widget_get_style_context(widget);
-    GtkStateFlags state = gtk_widget_get_state_flags(widget);
+    if (!priv->bg_valid)
+    {
+        GtkWidget *widget = GTK_WIDGET(view);
+        GtkStyleContext *context = gtk_widget_get_style_context(widget);
+        GtkStateFlags state = gtk_widget_get_state_flags(widget);
 
-    GdkRGBA rgba;
+        G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+        gtk_style_context_get_background_color(context, state,
+                                               &priv->bg_color);
+        G_GNUC_END_IGNORE_DEPRECATIONS
 
-    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
-    gtk_style_context_get_background_color(context, state, &rgba);
-    G_GNUC_END_IGNORE_DEPRECATIONS
+        priv->bg_valid = TRUE;
+    }
+
+    cairo_save(cr);
 
-    gdk_cairo_set_source_rgba(cr, &rgba);
+    gdk_cairo_set_source_rgba(cr, &priv->bg_color);
 
     GdkRectangle borders[4];
     GdkRectangle outer = {0, 0, alloc.width, alloc.height};
@@ -856,11 +970,16 @@ static void _uni_image_view_draw_background(UniImageView *view,
 
     for (int n = 0; n < 4; n++)
     {
+        GdkRectangle rect;
+
+        if (!gdk_rectangle_intersect(&borders[n], paint_rect, &rect))
+            continue;
+
         // Not sure why incrementing the size is necessary.
-        borders[n].width++;
-        borders[n].height++;
+        rect.width++;
+        rect.height++;
 
-        uni_draw_rect(cr, TRUE, &borders[n]);
+        uni_draw_rect(cr, TRUE, &rect);
     }
 
     cairo_restore(cr);
@@ -1383,9 +1502,7 @@ static void uni_image_view_scroll(UniImageView *view,
     else if (yscroll == GTK_SCROLL_PAGE_DOWN)
         ystep = v_page;
 
-    _uni_image_view_scroll_to(view,
-                              view->offset_x + xstep,
-                              view->offset_y + ystep, TRUE, FALSE);
+    uni_image_view_queue_offset(view, xstep, ystep, FALSE);
 }
 
 
@@ -1494,6 +1611,131 @@ void uni_image_view_set_offset(UniImageView *view,
     _uni_image_view_scroll_to(view, offset_x, offset_y, TRUE, invalidate);
 }
 
+/**
+ * uni_image_view_queue_offset:
+ * @view: A #UniImageView.
+ * @delta_x: X-component of the move in zoom space coordinates.
+ * @delta_y: Y-component of the move in zoom space coordinates.
+ * @invalidate: see uni_image_view_set_offset().
+ *
+ * Moves the offset by the given delta on the next frame clock update
+ * instead of immediately. Deltas queued before the next frame are
+ * summed, so a fast pointer generating many motion events per frame
+ * only costs one scroll and one repaint per frame.
+ *
+ * If the view is not realized, the offset is set immediately.
+ **/
+void uni_image_view_queue_offset(UniImageView *view,
+                                 gdouble delta_x, gdouble delta_y,
+                                 gboolean invalidate)
+{
+    g_return_if_fail(UNI_IS_IMAGE_VIEW(view));
+
+    UniImageViewPrivate *priv = view->priv;
+
+    priv->pending_dx += delta_x;
+    priv->pending_dy += delta_y;
+    priv->pending_invalidate |= invalidate;
+
+    if (!gtk_widget_get_realized(GTK_WIDGET(view)))
+    {
+        _uni_image_view_on_tick(GTK_WIDGET(view), NULL, NULL);
+        return;
+    }
+
+    if (priv->tick_id == 0)
+    {
+        priv->tick_id = gtk_widget_add_tick_callback(
+                                            GTK_WIDGET(view),
+                                            _uni_image_view_on_tick,
+                                            NULL, NULL);
+    }
+}
+
+static gboolean _uni_image_view_on_tick(GtkWidget *widget,
+                                        GdkFrameClock *clock,
+                                        gpointer data)
+{
+    (void) clock;
+    (void) data;
+
+    UniImageView *view = UNI_IMAGE_VIEW(widget);
+    UniImageViewPrivate *priv = view->priv;
+
+    gdouble offset_x = view->offset_x + priv->pending_dx;
+    gdouble offset_y = view->offset_y + priv->pending_dy;
+    gboolean invalidate = priv->pending_invalidate;
+
+    priv->pending_dx = 0.0;
+    priv->pending_dy = 0.0;
+    priv->pending_invalidate = FALSE;
+    priv->tick_id = 0;
+
+    _uni_image_view_scroll_to(view, offset_x, offset_y, TRUE, invalidate);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * uni_image_view_damage_pixels:
+ * @view: A #UniImageView.
+ * @rect: #GdkRectangle in image space coordinates to mark as damaged
+ *   or %NULL, to mark the whole pixbuf as damaged.
+ *
+ * Marks the pixels in the rectangle as damaged. That the pixels are
+ * damaged means that they have been modified in place and that the
+ * view must redraw them. Only the damaged area of the draw cache is
+ * scaled again and only the part of the widget showing it is redrawn.
+ **/
+void uni_image_view_damage_pixels(UniImageView *view, GdkRectangle *rect)
+{
+    g_return_if_fail(UNI_IS_IMAGE_VIEW(view));
+
+    if (!view->pixbuf)
+        return;
+
+    UniDragger *dragger = UNI_DRAGGER(view->dragger);
+
+    if (!rect)
+    {
+        uni_dragger_pixbuf_changed(dragger, FALSE, NULL);
+        gtk_widget_queue_draw(GTK_WIDGET(view));
+        return;
+    }
+
+    // to zoom space, with a margin for the interpolation filter which
+    // spreads each pixel over its neighbours.
+    int margin = (int) ceil(view->zoom) + 1;
+
+    GdkRectangle zoom_rect;
+    zoom_rect.x = (int) floor(rect->x * view->zoom) - margin;
+    zoom_rect.y = (int) floor(rect->y * view->zoom) - margin;
+    zoom_rect.width = (int) ceil((rect->x + rect->width) * view->zoom)
+                      + margin - zoom_rect.x;
+    zoom_rect.height = (int) ceil((rect->y + rect->height) * view->zoom)
+                       + margin - zoom_rect.y;
+
+    uni_dragger_pixbuf_changed(dragger, FALSE, &zoom_rect);
+
+    GdkWindow *window = gtk_widget_get_window(GTK_WIDGET(view));
+    if (!window)
+        return;
+
+    // to widget space
+    GdkRectangle image_area;
+    uni_image_view_get_draw_rect(view, &image_area);
+
+    GdkRectangle widget_rect;
+    widget_rect.x = image_area.x + zoom_rect.x - (int) floor(view->offset_x);
+    widget_rect.y = image_area.y + zoom_rect.y - (int) floor(view->offset_y);
+    widget_rect.width = zoom_rect.width + 1;
+    widget_rect.height = zoom_rect.height + 1;
+
+    GdkRectangle visible;
+    if (gdk_rectangle_intersect(&image_area, &widget_rect, &visible))
+        gdk_window_invalidate_rect(window, &visible, FALSE);
+}
+
 GtkAdjustment* uni_image_view_get_hadjustment(UniImageView *view)
 {
     return view->priv->hadjustment;
@@ -1548,6 +1790,9 @@ GdkPixbuf* uni_image_view_get_pixbuf(UniImageView *view)
 void uni_image_view_set_pixbuf(UniImageView *view,
                                GdkPixbuf *pixbuf, gboolean reset_fit)
 {
+    if (view->priv->prerender_src != pixbuf)
+        _uni_image_view_clear_prerender(view);
+
     if (view->pixbuf != pixbuf)
     {
         if (view->pixbuf)
@@ -1583,6 +1828,104 @@ void uni_image_view_set_pixbuf(UniImageView *view,
     uni_dragger_pixbuf_changed(UNI_DRAGGER(view->dragger), reset_fit, NULL);
 }
 
+/**
+ * uni_image_view_get_fit_zoom:
+ * @fitting: the fitting mode
+ * @width: width of the area to fit in
+ * @height: height of the area to fit in
+ * @img_width: width of the image
+ * @img_height: height of the image
+ * @returns: the zoom factor fitting mode @fitting would use
+ *
+ * Computes the zoom used to fit an image in an area. It only depends
+ * on its arguments so it can be used from other threads, for example
+ * to render an image at the size it will be displayed.
+ **/
+gdouble uni_image_view_get_fit_zoom(UniFittingMode fitting,
+                                    int width, int height,
+                                    int img_width, int img_height)
+{
+    gdouble ratio_x = (gdouble) width / img_width;
+    gdouble ratio_y = (gdouble) height / img_height;
+
+    gdouble zoom = MIN(ratio_y, ratio_x);
+
+    if (fitting == UNI_FITTING_NORMAL)
+        zoom = CLAMP(zoom, UNI_ZOOM_MIN, 1.0);
+    else if (fitting == UNI_FITTING_FULL)
+        zoom = CLAMP(zoom, UNI_ZOOM_MIN, UNI_ZOOM_MAX);
+
+    return zoom;
+}
+
+/**
+ * uni_image_view_set_prerender:
+ * @view: A #UniImageView.
+ * @pixbuf: The pixbuf that is about to be displayed.
+ * @scaled: The whole @pixbuf scaled at @zoom.
+ * @zoom: The zoom factor used to render @scaled.
+ * @interp: The interpolation used to render @scaled.
+ *
+ * Provides a rendering of the next pixbuf, made ahead of time. It must
+ * be called before uni_image_view_set_pixbuf() and is used as the
+ * initial draw cache contents if the view ends up displaying @pixbuf
+ * with the same zoom and interpolation, otherwise it's dropped at the
+ * first draw.
+ **/
+void uni_image_view_set_prerender(UniImageView *view,
+                                  GdkPixbuf *pixbuf,
+                                  GdkPixbuf *scaled,
+                                  gdouble zoom,
+                                  GdkInterpType interp)
+{
+    g_return_if_fail(UNI_IS_IMAGE_VIEW(view));
+    g_return_if_fail(GDK_IS_PIXBUF(pixbuf));
+    g_return_if_fail(GDK_IS_PIXBUF(scaled));
+
+    _uni_image_view_clear_prerender(view);
+
+    view->priv->prerender_src = g_object_ref(pixbuf);
+    view->priv->prerender = g_object_ref(scaled);
+    view->priv->prerender_zoom = zoom;
+    view->priv->prerender_interp = interp;
+}
+
+static void _uni_image_view_clear_prerender(UniImageView *view)
+{
+    g_clear_object(&view->priv->prerender_src);
+    g_clear_object(&view->priv->prerender);
+}
+
+static void _uni_image_view_adopt_prerender(UniImageView *view)
+{
+    UniImageViewPrivate *priv = view->priv;
+
+    if (!priv->prerender)
+        return;
+
+    if (view->pixbuf == priv->prerender_src
+        && view->zoom == priv->prerender_zoom
+        && view->interp == priv->prerender_interp)
+    {
+        UniDrawOpts opts;
+
+        opts.zoom = view->zoom;
+        opts.zoom_rect.x = 0;
+        opts.zoom_rect.y = 0;
+        opts.zoom_rect.width = gdk_pixbuf_get_width(priv->prerender);
+        opts.zoom_rect.height = gdk_pixbuf_get_height(priv->prerender);
+        opts.widget_x = 0;
+        opts.widget_y = 0;
+        opts.interp = view->interp;
+        opts.pixbuf = view->pixbuf;
+
+        uni_dragger_adopt_image(UNI_DRAGGER(view->dragger),
+                                &opts, priv->prerender);
+    }
+
+    _uni_image_view_clear_prerender(view);
+}
+
 void uni_image_view_set_zoom_mode(UniImageView *view, VnrPrefsZoom mode)
 {
     switch (mode)
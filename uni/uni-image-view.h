@@ -99,6 +99,10 @@ GType uni_image_view_get_type() G_GNUC_CONST;
 // constructors
 GtkWidget* uni_image_view_new();
 
+gdouble uni_image_view_get_fit_zoom(UniFittingMode fitting,
+                                    int width, int height,
+                                    int img_width, int img_height);
+
 // read-only properties
 gboolean uni_image_view_get_viewport(UniImageView *view, GdkRectangle *rect);
 gboolean uni_image_view_get_draw_rect(UniImageView *view, GdkRectangle *rect);
@@ -106,6 +110,9 @@ gboolean uni_image_view_get_draw_rect(UniImageView *view, GdkRectangle *rect);
 // write-only properties
 void uni_image_view_set_offset(UniImageView *view, gdouble x, gdouble y,
                                gboolean invalidate);
+void uni_image_view_queue_offset(UniImageView *view,
+                                 gdouble delta_x, gdouble delta_y,
+                                 gboolean invalidate);
 
 // read-write properties
 void uni_image_view_set_fitting(UniImageView *view, UniFittingMode fitting);
@@ -114,6 +121,11 @@ void uni_image_view_set_pixbuf(UniImageView *view, GdkPixbuf *pixbuf,
                                gboolean reset_fit);
 void uni_image_view_set_zoom(UniImageView *view, gdouble zoom);
 void uni_image_view_set_zoom_mode(UniImageView *view, VnrPrefsZoom mode);
+void uni_image_view_set_prerender(UniImageView *view,
+                                  GdkPixbuf *pixbuf,
+                                  GdkPixbuf *scaled,
+                                  gdouble zoom,
+                                  GdkInterpType interp);
 
 // actions
 void uni_image_view_zoom_in(UniImageView *view);
@@ -25,6 +25,12 @@
 
 #include <gdk/gdkx.h>
 #include <gdk/gdkwayland.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static gint _uni_get_session_type();
 
@@ -59,12 +65,288 @@ static gint _uni_get_session_type()
     return sessiontype;
 }
 
+/**
+ * _uni_pixbuf_scale_fast:
+ *
+ * Handles the zoom factors that don't need a resampling filter : 1:1
+ * is a plain copy of the source rows and integer magnification with
+ * GDK_INTERP_NEAREST replicates each source pixel into a zoom x zoom
+ * block, the repeated rows being copied from the first one. Returns
+ * %FALSE if the parameters don't match one of these cases, in which
+ * case nothing is drawn.
+ **/
+static gboolean _uni_pixbuf_scale_fast(GdkPixbuf *src,
+                                       GdkPixbuf *dst,
+                                       int dst_x,
+                                       int dst_y,
+                                       int dst_width,
+                                       int dst_height,
+                                       gdouble offset_x,
+                                       gdouble offset_y,
+                                       gdouble zoom,
+                                       GdkInterpType interp)
+{
+    int chans = gdk_pixbuf_get_n_channels(src);
+
+    if (chans != gdk_pixbuf_get_n_channels(dst)
+        || gdk_pixbuf_get_bits_per_sample(src) != 8
+        || offset_x != floor(offset_x)
+        || offset_y != floor(offset_y))
+    {
+        return FALSE;
+    }
+
+    int izoom = (int) zoom;
+
+    if (izoom < 1 || zoom != (gdouble) izoom)
+        return FALSE;
+
+    if (izoom > 1 && interp != GDK_INTERP_NEAREST)
+        return FALSE;
+
+    // top left corner of the area in zoom space
+    int zoom_x = dst_x - (int) offset_x;
+    int zoom_y = dst_y - (int) offset_y;
+
+    if (zoom_x < 0
+        || zoom_y < 0
+        || zoom_x + dst_width > gdk_pixbuf_get_width(src) * izoom
+        || zoom_y + dst_height > gdk_pixbuf_get_height(src) * izoom)
+    {
+        return FALSE;
+    }
+
+    int src_stride = gdk_pixbuf_get_rowstride(src);
+    int dst_stride = gdk_pixbuf_get_rowstride(dst);
+    const guchar *src_base = gdk_pixbuf_read_pixels(src);
+    guchar *dst_row = gdk_pixbuf_get_pixels(dst)
+                      + dst_y * dst_stride + dst_x * chans;
+
+    int linelen = dst_width * chans;
+
+    if (izoom == 1)
+    {
+        const guchar *src_row = src_base
+                                + zoom_y * src_stride + zoom_x * chans;
+
+        for (int y = 0; y < dst_height; ++y)
+        {
+            memcpy(dst_row, src_row, linelen);
+            src_row += src_stride;
+            dst_row += dst_stride;
+        }
+
+        return TRUE;
+    }
+
+    int last_sy = -1;
+
+    for (int y = 0; y < dst_height; ++y)
+    {
+        int sy = (zoom_y + y) / izoom;
+
+        if (sy == last_sy)
+        {
+            memcpy(dst_row, dst_row - dst_stride, linelen);
+            dst_row += dst_stride;
+            continue;
+        }
+
+        last_sy = sy;
+
+        const guchar *s = src_base + sy * src_stride
+                          + (zoom_x / izoom) * chans;
+        guchar *d = dst_row;
+
+        // the first source pixel may be partially visible
+        int run = izoom - zoom_x % izoom;
+        int x = 0;
+
+        if (chans == 4)
+        {
+            while (x < dst_width)
+            {
+                guint32 pixel;
+                memcpy(&pixel, s, 4);
+
+                int n = MIN(run, dst_width - x);
+
+                for (int k = 0; k < n; ++k, d += 4)
+                    memcpy(d, &pixel, 4);
+
+                x += n;
+                s += 4;
+                run = izoom;
+            }
+        }
+        else
+        {
+            while (x < dst_width)
+            {
+                int n = MIN(run, dst_width - x);
+
+                for (int k = 0; k < n; ++k, d += chans)
+                    memcpy(d, s, chans);
+
+                x += n;
+                s += chans;
+                run = izoom;
+            }
+        }
+
+        dst_row += dst_stride;
+    }
+
+    return TRUE;
+}
+
+// checkerboard ---------------------------------------------------------------
+
+// One RGBA row of the checkerboard pattern, starting with a light check.
+// Any row of the board is a window into it, offset by the column and row
+// parity, wider areas are blended in chunks of CHECK_ROW_LEN pixels. It's
+// rendered once and never modified afterwards so scaling threads can
+// share it.
+#define CHECK_ROW_LEN 512
+
+static guint32 _check_row[CHECK_ROW_LEN + 2 * CHECK_SIZE];
+
+static const guint32* _uni_get_check_row()
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized))
+    {
+        for (int x = 0; x < CHECK_ROW_LEN + 2 * CHECK_SIZE; ++x)
+        {
+            guint32 rgb = ((x / CHECK_SIZE) & 1) ? CHECK_DARK : CHECK_LIGHT;
+
+            guchar *p = (guchar*) (_check_row + x);
+            p[0] = (rgb >> 16) & 0xff;
+            p[1] = (rgb >> 8) & 0xff;
+            p[2] = rgb & 0xff;
+            p[3] = 0xff;
+        }
+
+        g_once_init_leave(&initialized, 1);
+    }
+
+    return _check_row;
+}
+
+static inline void _uni_blend_pixel(guchar *d, const guchar *c)
+{
+    int a = d[3];
+
+    for (int i = 0; i < 3; ++i)
+    {
+        int t = d[i] * a + c[i] * (255 - a) + 128;
+        d[i] = (t + (t >> 8)) >> 8;
+    }
+
+    d[3] = 0xff;
+}
+
+#ifdef __SSE2__
+static void _uni_blend_row(guchar *d, const guchar *c, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i opaque = _mm_set1_epi32((int) 0xff000000);
+
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4, d += 16, c += 16)
+    {
+        __m128i src = _mm_loadu_si128((const __m128i*) d);
+        __m128i chk = _mm_loadu_si128((const __m128i*) c);
+
+        __m128i s_lo = _mm_unpacklo_epi8(src, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(src, zero);
+        __m128i c_lo = _mm_unpacklo_epi8(chk, zero);
+        __m128i c_hi = _mm_unpackhi_epi8(chk, zero);
+
+        // broadcast the alpha of each pixel to its four lanes
+        __m128i a_lo = _mm_shufflehi_epi16(
+                        _mm_shufflelo_epi16(s_lo, 0xff), 0xff);
+        __m128i a_hi = _mm_shufflehi_epi16(
+                        _mm_shufflelo_epi16(s_hi, 0xff), 0xff);
+
+        // s * a + c * (255 - a), then divide by 255 with rounding
+        __m128i t_lo = _mm_add_epi16(
+                        _mm_mullo_epi16(s_lo, a_lo),
+                        _mm_mullo_epi16(c_lo, _mm_sub_epi16(mask, a_lo)));
+        __m128i t_hi = _mm_add_epi16(
+                        _mm_mullo_epi16(s_hi, a_hi),
+                        _mm_mullo_epi16(c_hi, _mm_sub_epi16(mask, a_hi)));
+
+        t_lo = _mm_add_epi16(t_lo, half);
+        t_hi = _mm_add_epi16(t_hi, half);
+        t_lo = _mm_srli_epi16(_mm_add_epi16(t_lo, _mm_srli_epi16(t_lo, 8)), 8);
+        t_hi = _mm_srli_epi16(_mm_add_epi16(t_hi, _mm_srli_epi16(t_hi, 8)), 8);
+
+        __m128i out = _mm_or_si128(_mm_packus_epi16(t_lo, t_hi), opaque);
+        _mm_storeu_si128((__m128i*) d, out);
+    }
+
+    for (; x < width; ++x, d += 4, c += 4)
+        _uni_blend_pixel(d, c);
+}
+#else
+static void _uni_blend_row(guchar *d, const guchar *c, int width)
+{
+    for (int x = 0; x < width; ++x, d += 4, c += 4)
+        _uni_blend_pixel(d, c);
+}
+#endif
+
+/**
+ * _uni_pixbuf_blend_checks:
+ *
+ * Composites an area of an RGBA pixbuf in place over the checkerboard,
+ * leaving it fully opaque. @check_x and @check_y are the coordinates of
+ * the area on the board so that adjacent areas line up.
+ **/
+static void _uni_pixbuf_blend_checks(GdkPixbuf *pixbuf,
+                                     int x, int y,
+                                     int width, int height,
+                                     int check_x, int check_y)
+{
+    const guint32 *checks = _uni_get_check_row();
+
+    int stride = gdk_pixbuf_get_rowstride(pixbuf);
+    guchar *row = gdk_pixbuf_get_pixels(pixbuf) + y * stride + x * 4;
+
+    for (int j = 0; j < height; ++j, row += stride)
+    {
+        int cy = (check_y + j) / CHECK_SIZE;
+        int start = (check_x + (cy & 1) * CHECK_SIZE) % (2 * CHECK_SIZE);
+
+        // CHECK_ROW_LEN is a multiple of the pattern period so each
+        // chunk starts with the same phase.
+        for (int i = 0; i < width; i += CHECK_ROW_LEN)
+        {
+            _uni_blend_row(row + i * 4,
+                           (const guchar*) (checks + start),
+                           MIN(CHECK_ROW_LEN, width - i));
+        }
+    }
+}
+
+
+// scaling --------------------------------------------------------------------
+
 /**
  * uni_pixbuf_scale_blend:
  *
  * A utility function that either scales or composites color depending
- * on the number of channels in the source image. The last four
- * parameters are only used in the composite color case.
+ * on the number of channels in the source image. The last two
+ * parameters are only used when the source has an alpha channel, if
+ * the destination has one too, the scaled pixels are blended in place
+ * over the checkerboard.
+ *
+ * It doesn't touch any shared state and may be used from worker threads.
  **/
 void uni_pixbuf_scale_blend(GdkPixbuf *src,
                             GdkPixbuf *dst,
@@ -77,7 +359,21 @@ void uni_pixbuf_scale_blend(GdkPixbuf *src,
                             gdouble zoom,
                             GdkInterpType interp, int check_x, int check_y)
 {
-    if (gdk_pixbuf_get_has_alpha(src))
+    if (gdk_pixbuf_get_has_alpha(src) && gdk_pixbuf_get_has_alpha(dst))
+    {
+        // scale the RGBA pixels as is then blend them over the
+        // pre-rendered checkerboard.
+        if (!_uni_pixbuf_scale_fast(src, dst,
+                                    dst_x, dst_y, dst_width, dst_height,
+                                    offset_x, offset_y, zoom, interp))
+            gdk_pixbuf_scale(src, dst,
+                             dst_x, dst_y, dst_width, dst_height,
+                             offset_x, offset_y, zoom, zoom, interp);
+
+        _uni_pixbuf_blend_checks(dst, dst_x, dst_y, dst_width, dst_height,
+                                 check_x, check_y);
+    }
+    else if (gdk_pixbuf_get_has_alpha(src))
         gdk_pixbuf_composite_color(src, dst,
                                    dst_x, dst_y, dst_width, dst_height,
                                    offset_x, offset_y,
@@ -86,7 +382,9 @@ void uni_pixbuf_scale_blend(GdkPixbuf *src,
                                    255,
                                    check_x, check_y,
                                    CHECK_SIZE, CHECK_LIGHT, CHECK_DARK);
-    else
+    else if (!_uni_pixbuf_scale_fast(src, dst,
+                                     dst_x, dst_y, dst_width, dst_height,
+                                     offset_x, offset_y, zoom, interp))
         gdk_pixbuf_scale(src, dst,
                          dst_x, dst_y, dst_width, dst_height,
                          offset_x, offset_y, zoom, zoom, interp);
@@ -0,0 +1,607 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "vnr-batch.h"
+
+#include "preferences.h"
+#include "gd-resize.h"
+#include "uni-exiv2.hpp"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Resize of many files without a display: they are decoded, scaled and
+    encoded in a pipeline whose stages are connected by bounded queues,
+    so that only a few images are held in memory at once.
+
+    gdk-pixbuf decodes and encodes a file on a single core, these stages
+    run in several threads working on different files. The scaling is
+    already spread on all the cores by gd_run_lines(), it runs in a
+    single thread.
+
+    The size and format are read from the header first: the JPEG and PNG
+    files that already fit are not decoded, they go straight to the
+    encoders which copy them.
+*/
+
+// at most one image per decoder and encoder, one scaled and the queued
+// ones are held, whatever the number of cores
+#define VNR_BATCH_MAX_WORKERS 4
+#define VNR_BATCH_QUEUE_SIZE 2
+
+typedef struct _VnrBatchItem
+{
+    gint index;
+    gchar *path;
+    gchar *format;
+    GdkPixbuf *pixbuf;
+    gboolean unscaled;
+
+} VnrBatchItem;
+
+typedef struct _VnrBatchQueue
+{
+    GMutex mutex;
+    GCond cond;
+    GQueue items;
+    guint capacity;
+    gint producers;         // closed once they are all done
+
+} VnrBatchQueue;
+
+typedef struct _VnrBatch
+{
+    gchar **files;
+    gint num_files;
+    gint next;              // next file to decode, atomic
+    gint *suffixes;         // of the files whose names are taken before
+
+    const gchar *outdir;
+    GStatBuf outdir_stat;
+
+    guint width;
+    guint height;
+    gdInterpolationMethod method;
+    gdScaleFlags flags;
+    gint jpeg_quality;
+    gint png_compression;
+
+    VnrBatchQueue scale_queue;
+    VnrBatchQueue encode_queue;
+
+    gint failed;            // atomic
+
+} VnrBatch;
+
+
+// queue ----------------------------------------------------------------------
+
+static void _vnr_batch_queue_init(VnrBatchQueue *queue,
+                                  guint capacity, gint producers)
+{
+    g_mutex_init(&queue->mutex);
+    g_cond_init(&queue->cond);
+    g_queue_init(&queue->items);
+    queue->capacity = capacity;
+    queue->producers = producers;
+}
+
+static void _vnr_batch_queue_clear(VnrBatchQueue *queue)
+{
+    g_mutex_clear(&queue->mutex);
+    g_cond_clear(&queue->cond);
+}
+
+static void _vnr_batch_queue_push(VnrBatchQueue *queue, VnrBatchItem *item)
+{
+    g_mutex_lock(&queue->mutex);
+
+    while (queue->items.length >= queue->capacity)
+        g_cond_wait(&queue->cond, &queue->mutex);
+
+    g_queue_push_tail(&queue->items, item);
+
+    g_cond_broadcast(&queue->cond);
+    g_mutex_unlock(&queue->mutex);
+}
+
+static VnrBatchItem* _vnr_batch_queue_pop(VnrBatchQueue *queue)
+{
+    // NULL once the queue is empty and closed
+    g_mutex_lock(&queue->mutex);
+
+    while (queue->items.length == 0 && queue->producers > 0)
+        g_cond_wait(&queue->cond, &queue->mutex);
+
+    VnrBatchItem *item = g_queue_pop_head(&queue->items);
+
+    g_cond_broadcast(&queue->cond);
+    g_mutex_unlock(&queue->mutex);
+
+    return item;
+}
+
+static void _vnr_batch_queue_close(VnrBatchQueue *queue)
+{
+    g_mutex_lock(&queue->mutex);
+
+    --queue->producers;
+
+    g_cond_broadcast(&queue->cond);
+    g_mutex_unlock(&queue->mutex);
+}
+
+
+// stages ---------------------------------------------------------------------
+
+static void _vnr_batch_item_free(VnrBatchItem *item)
+{
+    g_free(item->path);
+    g_free(item->format);
+
+    if (item->pixbuf)
+        g_object_unref(item->pixbuf);
+
+    g_free(item);
+}
+
+static void _vnr_batch_fail(VnrBatch *batch, const gchar *path,
+                            const gchar *message)
+{
+    fprintf(stderr, "imgview: %s: %s\n", path, message);
+
+    g_atomic_int_inc(&batch->failed);
+}
+
+// the formats the viewer saves are kept, the others become PNG files
+static const gchar* _vnr_batch_get_type(const gchar *format)
+{
+    return g_strcmp0(format, "jpeg") == 0 ? "jpeg" : "png";
+}
+
+// the orientation is kept in the metadata, the pixels stay as stored,
+// an image displayed turned by a quarter fits in the transposed box
+static void _vnr_batch_get_box(VnrBatch *batch, gboolean turned,
+                               guint *box_width, guint *box_height)
+{
+    *box_width = turned ? batch->height : batch->width;
+    *box_height = turned ? batch->width : batch->height;
+}
+
+static gboolean _vnr_batch_fits(VnrBatch *batch, const gchar *path,
+                                gint width, gint height)
+{
+    guint box_width;
+    guint box_height;
+
+    _vnr_batch_get_box(batch, false, &box_width, &box_height);
+
+    gboolean fits = ((guint) width <= box_width
+                     && (guint) height <= box_height);
+
+    _vnr_batch_get_box(batch, true, &box_width, &box_height);
+
+    gboolean fits_turned = ((guint) width <= box_width
+                            && (guint) height <= box_height);
+
+    // the metadata is only read when the orientation matters
+    if (fits == fits_turned)
+        return fits;
+
+    return uni_read_exiv2_orientation(path) >= 5 ? fits_turned : fits;
+}
+
+static gpointer _vnr_batch_decode_thread(VnrBatch *batch)
+{
+    gint i;
+
+    while ((i = g_atomic_int_add(&batch->next, 1)) < batch->num_files)
+    {
+        const gchar *path = batch->files[i];
+
+        gint width = 0;
+        gint height = 0;
+        GdkPixbufFormat *format = gdk_pixbuf_get_file_info(path,
+                                                           &width, &height);
+
+        VnrBatchItem *item = g_new0(VnrBatchItem, 1);
+        item->index = i;
+        item->path = g_strdup(path);
+        item->format = format ? gdk_pixbuf_format_get_name(format) : NULL;
+
+        // copied by the encoders, see above
+        if (format
+            && g_strcmp0(_vnr_batch_get_type(item->format), item->format) == 0
+            && _vnr_batch_fits(batch, path, width, height))
+        {
+            item->unscaled = true;
+
+            _vnr_batch_queue_push(&batch->encode_queue, item);
+            continue;
+        }
+
+        GError *error = NULL;
+        item->pixbuf = gdk_pixbuf_new_from_file(path, &error);
+
+        if (!item->pixbuf)
+        {
+            _vnr_batch_fail(batch, path, error->message);
+            g_error_free(error);
+            _vnr_batch_item_free(item);
+            continue;
+        }
+
+        _vnr_batch_queue_push(&batch->scale_queue, item);
+    }
+
+    _vnr_batch_queue_close(&batch->scale_queue);
+    _vnr_batch_queue_close(&batch->encode_queue);
+
+    return NULL;
+}
+
+static gboolean _vnr_batch_scale(VnrBatch *batch, VnrBatchItem *item)
+{
+    int width = gdk_pixbuf_get_width(item->pixbuf);
+    int height = gdk_pixbuf_get_height(item->pixbuf);
+
+    const gchar *orientation = gdk_pixbuf_get_option(item->pixbuf,
+                                                     "orientation");
+    guint box_width;
+    guint box_height;
+
+    _vnr_batch_get_box(batch, orientation && atoi(orientation) >= 5,
+                       &box_width, &box_height);
+
+    gdouble scale = MIN((gdouble) box_width / width,
+                        (gdouble) box_height / height);
+
+    // smaller images are never enlarged
+    if (scale >= 1.0)
+    {
+        item->unscaled = true;
+        return true;
+    }
+
+    guint new_width = MAX(1, (guint) (width * scale + 0.5));
+    guint new_height = MAX(1, (guint) (height * scale + 0.5));
+
+    GdkPixbuf *scaled = gd_pixbuf_scale_full(item->pixbuf,
+                                             new_width, new_height,
+                                             batch->method, batch->flags);
+    if (!scaled)
+        return false;
+
+    g_object_unref(item->pixbuf);
+    item->pixbuf = scaled;
+
+    return true;
+}
+
+static gpointer _vnr_batch_scale_thread(VnrBatch *batch)
+{
+    VnrBatchItem *item;
+
+    while ((item = _vnr_batch_queue_pop(&batch->scale_queue)))
+    {
+        if (!_vnr_batch_scale(batch, item))
+        {
+            _vnr_batch_fail(batch, item->path,
+                            _("Not enough virtual memory."));
+            _vnr_batch_item_free(item);
+            continue;
+        }
+
+        _vnr_batch_queue_push(&batch->encode_queue, item);
+    }
+
+    _vnr_batch_queue_close(&batch->encode_queue);
+
+    return NULL;
+}
+
+static gchar* _vnr_batch_get_output(VnrBatch *batch, VnrBatchItem *item,
+                                    const gchar *type)
+{
+    gchar *dirname = g_path_get_dirname(item->path);
+
+    GStatBuf st;
+    gboolean same = (g_stat(dirname, &st) == 0
+                     && st.st_dev == batch->outdir_stat.st_dev
+                     && st.st_ino == batch->outdir_stat.st_ino);
+    g_free(dirname);
+
+    // never replace a source file
+    if (same)
+        return NULL;
+
+    gchar *basename = g_path_get_basename(item->path);
+    gchar *extension = NULL;
+
+    gchar *dot = strrchr(basename, '.');
+
+    if (dot && dot != basename)
+    {
+        extension = g_strdup(dot);
+        *dot = '\0';
+    }
+
+    if (g_strcmp0(type, item->format) != 0)
+    {
+        g_free(extension);
+        extension = g_strconcat(".", type, NULL);
+    }
+
+    gchar *name;
+
+    if (batch->suffixes[item->index] > 0)
+    {
+        name = g_strdup_printf("%s-%d%s", basename,
+                               batch->suffixes[item->index],
+                               extension ? extension : "");
+    }
+    else
+    {
+        name = g_strconcat(basename, extension, NULL);
+    }
+
+    gchar *output = g_build_filename(batch->outdir, name, NULL);
+
+    g_free(name);
+    g_free(extension);
+    g_free(basename);
+
+    return output;
+}
+
+// the files of different directories with the same name, but for the
+// extension, are numbered in the order given, the first keeps its name and
+// a number is not taken if a file has the numbered name
+static gint* _vnr_batch_get_suffixes(gchar **files, gint num_files)
+{
+    gint *suffixes = g_new0(gint, num_files);
+    GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, NULL);
+
+    for (gint i = 0; i < num_files; ++i)
+    {
+        gchar *name = g_path_get_basename(files[i]);
+
+        gchar *dot = strrchr(name, '.');
+        if (dot && dot != name)
+            *dot = '\0';
+
+        gint count = GPOINTER_TO_INT(g_hash_table_lookup(names, name));
+        gint suffix = 0;
+        gchar *unique = g_strdup(name);
+
+        while (g_hash_table_contains(names, unique))
+        {
+            g_free(unique);
+            suffix = ++count;
+            unique = g_strdup_printf("%s-%d", name, suffix);
+        }
+
+        suffixes[i] = suffix;
+
+        // the last number of the name, and the numbered name taken
+        g_hash_table_replace(names, name, GINT_TO_POINTER(count));
+
+        if (suffix > 0)
+            g_hash_table_replace(names, unique, GINT_TO_POINTER(0));
+        else
+            g_free(unique);
+    }
+
+    g_hash_table_destroy(names);
+
+    return suffixes;
+}
+
+static void _vnr_batch_save(VnrBatch *batch, VnrBatchItem *item)
+{
+    const gchar *type = _vnr_batch_get_type(item->format);
+
+    gchar *output = _vnr_batch_get_output(batch, item, type);
+
+    if (!output)
+    {
+        _vnr_batch_fail(batch, item->path,
+                        _("The output directory contains the file."));
+        return;
+    }
+
+    GError *error = NULL;
+    gchar *buffer = NULL;
+    gsize size = 0;
+    gboolean saved;
+
+    // a file kept in its format and size is copied, not encoded again
+    gboolean copied = (item->unscaled
+                       && g_strcmp0(type, item->format) == 0);
+
+    if (copied)
+    {
+        saved = g_file_get_contents(item->path, &buffer, &size, &error)
+                && g_file_set_contents(output, buffer, size, &error);
+    }
+    else if (g_strcmp0(type, "jpeg") == 0)
+    {
+        gchar *quality = g_strdup_printf("%i", batch->jpeg_quality);
+
+        saved = gdk_pixbuf_save_to_buffer(
+                    item->pixbuf, &buffer, &size, "jpeg",
+                    &error, "quality", quality, NULL);
+
+        g_free(quality);
+    }
+    else
+    {
+        gchar *compression;
+        compression = g_strdup_printf("%i", batch->png_compression);
+
+        saved = gdk_pixbuf_save_to_buffer(
+                    item->pixbuf, &buffer, &size, "png",
+                    &error, "compression", compression, NULL);
+
+        g_free(compression);
+    }
+
+    if (saved && !copied)
+    {
+        uni_copy_exiv2_to_buffer(item->path, &buffer, &size);
+
+        saved = g_file_set_contents(output, buffer, size, &error);
+    }
+
+    if (saved)
+        printf("%s\n", output);
+    else
+        _vnr_batch_fail(batch, item->path, error->message);
+
+    g_clear_error(&error);
+    g_free(buffer);
+    g_free(output);
+}
+
+static gpointer _vnr_batch_encode_thread(VnrBatch *batch)
+{
+    VnrBatchItem *item;
+
+    while ((item = _vnr_batch_queue_pop(&batch->encode_queue)))
+    {
+        _vnr_batch_save(batch, item);
+        _vnr_batch_item_free(item);
+    }
+
+    return NULL;
+}
+
+
+// public ---------------------------------------------------------------------
+
+/**
+ * vnr_batch_resize:
+ * @files: the files to resize
+ * @size: the box the images must fit in, as "WxH"
+ * @filter: a libgd interpolation method name, or %NULL for lanczos3
+ * @outdir: the directory of the resized files, created if needed
+ * @returns: the exit status, 1 if a file failed.
+ *
+ * Saves the JPEG and PNG files with the quality and compression of the
+ * preferences, the other formats as PNG, and copies their metadata. The
+ * JPEG and PNG files that already fit are copied without being decoded.
+ * The files of different directories with the same name are numbered.
+ **/
+int vnr_batch_resize(gchar **files, const gchar *size,
+                     const gchar *filter, const gchar *outdir)
+{
+    VnrBatch batch = {0};
+
+    if (sscanf(size, "%ux%u", &batch.width, &batch.height) != 2
+        || batch.width < 1 || batch.height < 1)
+    {
+        fprintf(stderr, "imgview: invalid size \"%s\"\n", size);
+        return 1;
+    }
+
+    batch.method = GD_LANCZOS3;
+
+    if (filter && !gd_interpolation_method_from_name(filter, &batch.method))
+    {
+        fprintf(stderr, "imgview: unknown filter \"%s\"\n", filter);
+        return 1;
+    }
+
+    if (!outdir)
+    {
+        fprintf(stderr, "imgview: no output directory, see --out\n");
+        return 1;
+    }
+
+    if (g_mkdir_with_parents(outdir, 0755) != 0
+        || g_stat(outdir, &batch.outdir_stat) != 0)
+    {
+        fprintf(stderr, "imgview: %s: %s\n", outdir, g_strerror(errno));
+        return 1;
+    }
+
+    batch.files = files;
+    batch.num_files = files ? g_strv_length(files) : 0;
+    batch.suffixes = _vnr_batch_get_suffixes(files, batch.num_files);
+    batch.outdir = outdir;
+
+    // the preferences of the viewer, without its window
+    VnrPrefs *prefs = VNR_PREFS(vnr_prefs_new(NULL));
+
+    batch.jpeg_quality = prefs->jpeg_quality;
+    batch.png_compression = prefs->png_compression;
+    batch.flags = prefs->resize_linear_light ? GD_SCALE_LINEAR_LIGHT
+                                             : GD_SCALE_DEFAULT;
+
+    g_object_unref(prefs);
+
+    gint num_workers = CLAMP((gint) g_get_num_processors() / 2,
+                             1, VNR_BATCH_MAX_WORKERS);
+
+    _vnr_batch_queue_init(&batch.scale_queue,
+                          VNR_BATCH_QUEUE_SIZE, num_workers);
+    // the scaler and the decoders, which push the files to copy
+    _vnr_batch_queue_init(&batch.encode_queue,
+                          VNR_BATCH_QUEUE_SIZE, num_workers + 1);
+
+    GThread **decoders = g_new0(GThread*, num_workers);
+    GThread **encoders = g_new0(GThread*, num_workers);
+
+    for (gint i = 0; i < num_workers; ++i)
+    {
+        decoders[i] = g_thread_new("batch-decode",
+                                   (GThreadFunc) _vnr_batch_decode_thread,
+                                   &batch);
+        encoders[i] = g_thread_new("batch-encode",
+                                   (GThreadFunc) _vnr_batch_encode_thread,
+                                   &batch);
+    }
+
+    GThread *scaler = g_thread_new("batch-scale",
+                                   (GThreadFunc) _vnr_batch_scale_thread,
+                                   &batch);
+
+    for (gint i = 0; i < num_workers; ++i)
+        g_thread_join(decoders[i]);
+
+    g_thread_join(scaler);
+
+    for (gint i = 0; i < num_workers; ++i)
+        g_thread_join(encoders[i]);
+
+    g_free(decoders);
+    g_free(encoders);
+    g_free(batch.suffixes);
+
+    _vnr_batch_queue_clear(&batch.scale_queue);
+    _vnr_batch_queue_clear(&batch.encode_queue);
+
+    return batch.failed > 0 ? 1 : 0;
+}
+
+
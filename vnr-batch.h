@@ -0,0 +1,28 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VNR_BATCH_H__
+#define __VNR_BATCH_H__
+
+#include <glib.h>
+
+int vnr_batch_resize(gchar **files, const gchar *size,
+                     const gchar *filter, const gchar *outdir);
+
+#endif // __VNR_BATCH_H__
+
+
@@ -0,0 +1,869 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "vnr-edits.h"
+
+#include "gd-rotate.h"
+#include <math.h>
+#include <string.h>
+
+/*
+    The edits are folded in a single state: an area of the source, a
+    horizontal flip, a number of clockwise quarter turns, the size of the
+    result and one colour matrix. Rendering crops with a sub-pixbuf,
+    scales the area once, then orients and colours the scaled pixels.
+
+    A crop made after a resize is rounded to whole source pixels.
+
+    The previews are rendered to fit the preview size, the size the view
+    shows them at, and are never enlarged. The area is scaled straight to
+    that size, so the preview of a large image costs about as much as the
+    pixels on screen. The saved result is rendered at full size.
+
+    Undo and redo move edits between the list and the redo list, nothing
+    is stored but the edits themselves. To undo without rendering again,
+    the previews are kept in a cache of a limited size, the oldest first
+    out, the last one always. A preview that shares the source pixels
+    costs nothing.
+
+    When the next edit orients or colours, its preview is made from the
+    one before it if that gives the size it should have. Crops and resizes
+    are rendered from the source.
+
+    Crops share the source pixels until the image is saved. If the area
+    then leaves most of the source unused, the source is replaced by a
+    copy of the area and the list by the few edits that give the same
+    state from it: undo stops at the crop, redo is kept as the redo edits
+    are relative to the result.
+*/
+
+typedef struct
+{
+    GdkRectangle area;      // area of the source
+    gboolean flip;          // horizontal flip, applied before the turns
+    gint turns;             // clockwise quarter turns
+    gint width;             // size of the result
+    gint height;
+    gdScaleFlags flags;
+
+    gboolean has_color;
+    gdColorMatrix color;
+
+} VnrEditState;
+
+typedef struct
+{
+    guint count;            // number of edits rendered
+    GdkPixbuf *pixbuf;
+    gsize size;
+
+} VnrEditsPreview;
+
+struct _VnrEdits
+{
+    GdkPixbuf *source;
+    GArray *list;
+    GArray *redo;
+    VnrEditState state;
+    guint saved;            // number of edits saved, G_MAXUINT if undone
+    gboolean stored;        // the file still holds the source
+
+    // the redo list and saved count before the last push, given back if
+    // that edit is cancelled
+    GArray *dropped;
+    guint dropped_saved;
+
+    // the box the previews fit in, 0 for the full size
+    gint preview_width;
+    gint preview_height;
+
+    GQueue cache;
+    gsize cache_size;
+    gsize cache_limit;
+};
+
+#define VNR_EDITS_CACHE_LIMIT (256 << 20)
+
+// rotations of the clockwise quarter turns
+static const GdkPixbufRotation _vnr_edits_angles[4] =
+{
+    GDK_PIXBUF_ROTATE_NONE,
+    GDK_PIXBUF_ROTATE_CLOCKWISE,
+    GDK_PIXBUF_ROTATE_UPSIDEDOWN,
+    GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE,
+};
+
+// the source is compacted when the area uses less than this part of it
+#define VNR_EDITS_COMPACT_RATIO 0.5
+
+static void _vnr_edits_apply(VnrEditState *state, const VnrEdit *edit);
+static void _vnr_edits_refold(VnrEdits *edits);
+static void _vnr_edits_cache_trim(VnrEdits *edits, guint count);
+static void _vnr_edits_append_state(GArray *list, const VnrEditState *state);
+
+
+// creation / destruction -----------------------------------------------------
+
+VnrEdits* vnr_edits_new(GdkPixbuf *source)
+{
+    g_return_val_if_fail(source != NULL, NULL);
+
+    VnrEdits *edits = g_new0(VnrEdits, 1);
+
+    edits->source = g_object_ref(source);
+    edits->list = g_array_new(FALSE, FALSE, sizeof(VnrEdit));
+    edits->redo = g_array_new(FALSE, FALSE, sizeof(VnrEdit));
+    edits->dropped = g_array_new(FALSE, FALSE, sizeof(VnrEdit));
+    edits->cache_limit = VNR_EDITS_CACHE_LIMIT;
+    edits->stored = TRUE;
+    g_queue_init(&edits->cache);
+
+    _vnr_edits_refold(edits);
+
+    return edits;
+}
+
+// the edits without the previews, to render them in another thread
+VnrEdits* vnr_edits_copy(VnrEdits *edits)
+{
+    VnrEdits *copy = vnr_edits_new(edits->source);
+
+    g_array_append_vals(copy->list, edits->list->data, edits->list->len);
+    copy->saved = edits->saved;
+    copy->stored = edits->stored;
+
+    _vnr_edits_refold(copy);
+
+    return copy;
+}
+
+void vnr_edits_free(VnrEdits *edits)
+{
+    if (!edits)
+        return;
+
+    _vnr_edits_cache_trim(edits, 0);
+
+    g_object_unref(edits->source);
+    g_array_free(edits->list, TRUE);
+    g_array_free(edits->redo, TRUE);
+    g_array_free(edits->dropped, TRUE);
+    g_free(edits);
+}
+
+
+// properties -----------------------------------------------------------------
+
+GdkPixbuf* vnr_edits_get_source(VnrEdits *edits)
+{
+    return edits->source;
+}
+
+guint vnr_edits_get_count(VnrEdits *edits)
+{
+    return edits->list->len;
+}
+
+/**
+ * vnr_edits_set_cache_limit:
+ * @edits: the edits
+ * @limit: the bytes of previews kept for undo and redo
+ **/
+void vnr_edits_set_cache_limit(VnrEdits *edits, gsize limit)
+{
+    edits->cache_limit = limit;
+
+    _vnr_edits_cache_trim(edits, G_MAXUINT);
+}
+
+void vnr_edits_push(VnrEdits *edits, const VnrEdit *edit)
+{
+    g_array_append_val(edits->list, *edit);
+
+    _vnr_edits_apply(&edits->state, edit);
+
+    // the redo branch is lost with its previews, the edits are kept until
+    // the next push in case this one is cancelled
+    GArray *redo = edits->redo;
+    edits->redo = edits->dropped;
+    edits->dropped = redo;
+    edits->dropped_saved = edits->saved;
+
+    g_array_set_size(edits->redo, 0);
+    _vnr_edits_cache_trim(edits, edits->list->len);
+
+    if (edits->saved != G_MAXUINT && edits->saved >= edits->list->len)
+        edits->saved = G_MAXUINT;
+}
+
+/**
+ * vnr_edits_cancel:
+ * @edits: the edits
+ * @returns: %FALSE if there was no edit.
+ *
+ * Removes the edit of the last vnr_edits_push(), when its result can't be
+ * shown, and gives back the redo list the push dropped.
+ **/
+gboolean vnr_edits_cancel(VnrEdits *edits)
+{
+    if (!vnr_edits_pop(edits, NULL))
+        return FALSE;
+
+    GArray *redo = edits->redo;
+    edits->redo = edits->dropped;
+    edits->dropped = redo;
+    edits->saved = edits->dropped_saved;
+
+    g_array_set_size(edits->dropped, 0);
+
+    return TRUE;
+}
+
+/**
+ * vnr_edits_pop:
+ * @edits: the edits
+ * @edit: receives the last edit or %NULL
+ * @returns: %FALSE if there was no edit.
+ **/
+gboolean vnr_edits_pop(VnrEdits *edits, VnrEdit *edit)
+{
+    if (edits->list->len == 0)
+        return FALSE;
+
+    if (edit)
+        *edit = g_array_index(edits->list, VnrEdit, edits->list->len - 1);
+
+    g_array_set_size(edits->list, edits->list->len - 1);
+
+    _vnr_edits_refold(edits);
+
+    return TRUE;
+}
+
+gboolean vnr_edits_undo(VnrEdits *edits)
+{
+    VnrEdit edit;
+
+    if (!vnr_edits_pop(edits, &edit))
+        return FALSE;
+
+    g_array_append_val(edits->redo, edit);
+
+    return TRUE;
+}
+
+gboolean vnr_edits_redo(VnrEdits *edits)
+{
+    if (edits->redo->len == 0)
+        return FALSE;
+
+    const VnrEdit *edit = &g_array_index(edits->redo, VnrEdit,
+                                         edits->redo->len - 1);
+
+    g_array_append_val(edits->list, *edit);
+    _vnr_edits_apply(&edits->state, edit);
+
+    g_array_set_size(edits->redo, edits->redo->len - 1);
+
+    return TRUE;
+}
+
+void vnr_edits_set_saved(VnrEdits *edits)
+{
+    edits->saved = edits->list->len;
+
+    if (edits->list->len > 0)
+        edits->stored = FALSE;
+}
+
+gboolean vnr_edits_is_modified(VnrEdits *edits)
+{
+    return edits->saved != edits->list->len;
+}
+
+void vnr_edits_get_size(VnrEdits *edits, gint *width, gint *height)
+{
+    *width = edits->state.width;
+    *height = edits->state.height;
+}
+
+/**
+ * vnr_edits_set_preview_size:
+ * @edits: the edits
+ * @width: the width the previews fit in, 0 for the full size
+ * @height: the height the previews fit in, 0 for the full size
+ **/
+void vnr_edits_set_preview_size(VnrEdits *edits, gint width, gint height)
+{
+    if (width < 1 || height < 1)
+        width = height = 0;
+
+    if (width == edits->preview_width && height == edits->preview_height)
+        return;
+
+    edits->preview_width = width;
+    edits->preview_height = height;
+
+    // the previews of the last size
+    _vnr_edits_cache_trim(edits, 0);
+}
+
+/**
+ * vnr_edits_compact:
+ * @edits: the edits
+ * @returns: %TRUE if the source was replaced, the previews are then
+ *           dropped.
+ *
+ * Releases the source pixels that a crop leaves unused, see above. The
+ * render is the same before and after.
+ **/
+gboolean vnr_edits_compact(VnrEdits *edits)
+{
+    const GdkRectangle *area = &edits->state.area;
+    const gdouble source_size = (gdouble) gdk_pixbuf_get_width(edits->source)
+                                * gdk_pixbuf_get_height(edits->source);
+
+    if ((gdouble) area->width * area->height
+        >= source_size * VNR_EDITS_COMPACT_RATIO)
+    {
+        return FALSE;
+    }
+
+    GdkPixbuf *sub = gdk_pixbuf_new_subpixbuf(edits->source,
+                                              area->x, area->y,
+                                              area->width, area->height);
+    if (sub == NULL)
+        return FALSE;
+
+    // a copy of a sub-pixbuf has its own, packed pixels
+    GdkPixbuf *source = gdk_pixbuf_copy(sub);
+    g_object_unref(sub);
+
+    if (source == NULL)
+        return FALSE;
+
+    const gboolean modified = vnr_edits_is_modified(edits);
+
+    _vnr_edits_cache_trim(edits, 0);
+
+    g_object_unref(edits->source);
+    edits->source = source;
+
+    g_array_set_size(edits->list, 0);
+    g_array_set_size(edits->dropped, 0);
+    _vnr_edits_append_state(edits->list, &edits->state);
+
+    _vnr_edits_refold(edits);
+
+    edits->saved = modified ? G_MAXUINT : edits->list->len;
+
+    return TRUE;
+}
+
+/**
+ * vnr_edits_get_lossless:
+ * @edits: the edits
+ * @orientation: the Exif orientation of the file, 1 to 8, applied when
+ *               the source was loaded
+ * @width: the size of the stored image, before the orientation
+ * @height:
+ * @area: receives the area of the stored image
+ * @flip: receives the horizontal flip, done before the rotation
+ * @angle: receives the rotation
+ * @returns: %FALSE if the edits resize or colour or if the stored image
+ *           isn't the source, as after a save.
+ *
+ * Gets the result as a crop and an orientation of the stored image, for
+ * the transforms that don't decode it.
+ **/
+gboolean vnr_edits_get_lossless(VnrEdits *edits, gint orientation,
+                                gint width, gint height,
+                                GdkRectangle *area, gboolean *flip,
+                                GdkPixbufRotation *angle)
+{
+    // flips and clockwise turns of the Exif orientations
+    static const gint orientations[8][2] =
+    {
+        {0, 0}, {1, 0}, {0, 2}, {1, 2}, {1, 3}, {0, 1}, {1, 1}, {0, 3},
+    };
+
+    if (orientation < 1 || orientation > 8)
+        orientation = 1;
+
+    const gboolean swap = (orientations[orientation - 1][1] % 2);
+
+    if (!edits->stored
+        || (swap ? height : width) != gdk_pixbuf_get_width(edits->source)
+        || (swap ? width : height) != gdk_pixbuf_get_height(edits->source))
+    {
+        return FALSE;
+    }
+
+    VnrEditState state = {0};
+    state.area.width = width;
+    state.area.height = height;
+    state.width = width;
+    state.height = height;
+
+    // the orientation is the first edit
+    VnrEditState oriented = {0};
+    oriented.flip = orientations[orientation - 1][0];
+    oriented.turns = orientations[orientation - 1][1];
+
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(VnrEdit));
+    _vnr_edits_append_state(list, &oriented);
+    g_array_append_vals(list, edits->list->data, edits->list->len);
+
+    for (guint i = 0; i < list->len; ++i)
+        _vnr_edits_apply(&state, &g_array_index(list, VnrEdit, i));
+
+    g_array_free(list, TRUE);
+
+    const gboolean swapped = (state.turns % 2);
+
+    if (state.has_color
+        || state.width != (swapped ? state.area.height : state.area.width)
+        || state.height != (swapped ? state.area.width : state.area.height))
+    {
+        return FALSE;
+    }
+
+    *area = state.area;
+    *flip = state.flip;
+    *angle = _vnr_edits_angles[state.turns];
+
+    return TRUE;
+}
+
+
+// folding --------------------------------------------------------------------
+
+static gint _vnr_edits_map(gint value, gint from, gint to)
+{
+    return (gint) floor((gdouble) value * to / from + 0.5);
+}
+
+static void _vnr_edits_apply_crop(VnrEditState *state,
+                                  const GdkRectangle *area)
+{
+    // the crop area in the oriented, unscaled frame
+    const gboolean swap = (state->turns % 2);
+    gint frame_w = swap ? state->area.height : state->area.width;
+    gint frame_h = swap ? state->area.width : state->area.height;
+
+    gint x0 = _vnr_edits_map(area->x, state->width, frame_w);
+    gint y0 = _vnr_edits_map(area->y, state->height, frame_h);
+    gint x1 = _vnr_edits_map(area->x + area->width, state->width, frame_w);
+    gint y1 = _vnr_edits_map(area->y + area->height, state->height, frame_h);
+
+    x0 = CLAMP(x0, 0, frame_w - 1);
+    y0 = CLAMP(y0, 0, frame_h - 1);
+    x1 = CLAMP(x1, x0 + 1, frame_w);
+    y1 = CLAMP(y1, y0 + 1, frame_h);
+
+    GdkRectangle rect = {x0, y0, x1 - x0, y1 - y0};
+
+    // undo the turns, counterclockwise
+    for (gint i = 0; i < state->turns; ++i)
+    {
+        GdkRectangle turned = {rect.y, frame_w - rect.x - rect.width,
+                               rect.height, rect.width};
+        rect = turned;
+
+        gint tmp = frame_w;
+        frame_w = frame_h;
+        frame_h = tmp;
+    }
+
+    if (state->flip)
+        rect.x = frame_w - rect.x - rect.width;
+
+    rect.x += state->area.x;
+    rect.y += state->area.y;
+
+    state->area = rect;
+    state->width = area->width;
+    state->height = area->height;
+}
+
+static void _vnr_edits_apply(VnrEditState *state, const VnrEdit *edit)
+{
+    switch (edit->type)
+    {
+    case VNR_EDIT_ROTATE:
+    {
+        gint turns = 0;
+
+        if (edit->angle == GDK_PIXBUF_ROTATE_CLOCKWISE)
+            turns = 1;
+        else if (edit->angle == GDK_PIXBUF_ROTATE_UPSIDEDOWN)
+            turns = 2;
+        else if (edit->angle == GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE)
+            turns = 3;
+
+        state->turns = (state->turns + turns) % 4;
+
+        if (turns % 2)
+        {
+            gint tmp = state->width;
+            state->width = state->height;
+            state->height = tmp;
+        }
+
+        break;
+    }
+
+    case VNR_EDIT_FLIP:
+        // a flip after t turns is a flip before -t turns,
+        // a vertical flip is a horizontal one and a half turn
+        state->flip = !state->flip;
+        state->turns = ((edit->horizontal ? 4 : 6) - state->turns) % 4;
+        break;
+
+    case VNR_EDIT_CROP:
+        _vnr_edits_apply_crop(state, &edit->area);
+        break;
+
+    case VNR_EDIT_RESIZE:
+        state->width = edit->size.width;
+        state->height = edit->size.height;
+        state->flags = edit->size.flags;
+        break;
+
+    case VNR_EDIT_COLOR:
+        if (state->has_color)
+        {
+            gd_color_matrix_multiply(&state->color,
+                                     &edit->matrix, &state->color);
+        }
+        else
+        {
+            state->color = edit->matrix;
+            state->has_color = TRUE;
+        }
+
+        break;
+    }
+}
+
+// the edits giving state from its area of the source
+static void _vnr_edits_append_state(GArray *list, const VnrEditState *state)
+{
+    if (state->flip)
+    {
+        VnrEdit edit = {.type = VNR_EDIT_FLIP, .horizontal = TRUE};
+        g_array_append_val(list, edit);
+    }
+
+    if (state->turns > 0)
+    {
+        VnrEdit edit = {.type = VNR_EDIT_ROTATE,
+                        .angle = _vnr_edits_angles[state->turns]};
+        g_array_append_val(list, edit);
+    }
+
+    const gboolean swap = (state->turns % 2);
+
+    if (state->width != (swap ? state->area.height : state->area.width)
+        || state->height != (swap ? state->area.width : state->area.height))
+    {
+        VnrEdit edit = {.type = VNR_EDIT_RESIZE};
+        edit.size.width = state->width;
+        edit.size.height = state->height;
+        edit.size.flags = state->flags;
+        g_array_append_val(list, edit);
+    }
+
+    if (state->has_color)
+    {
+        VnrEdit edit = {.type = VNR_EDIT_COLOR, .matrix = state->color};
+        g_array_append_val(list, edit);
+    }
+}
+
+static void _vnr_edits_refold(VnrEdits *edits)
+{
+    VnrEditState *state = &edits->state;
+
+    memset(state, 0, sizeof(*state));
+    state->area.width = gdk_pixbuf_get_width(edits->source);
+    state->area.height = gdk_pixbuf_get_height(edits->source);
+    state->width = state->area.width;
+    state->height = state->area.height;
+
+    for (guint i = 0; i < edits->list->len; ++i)
+        _vnr_edits_apply(state, &g_array_index(edits->list, VnrEdit, i));
+}
+
+
+// render ---------------------------------------------------------------------
+
+static GdkPixbuf* _vnr_edits_replace(GdkPixbuf *pixbuf, GdkPixbuf *result)
+{
+    g_object_unref(pixbuf);
+
+    return result;
+}
+
+// the size of the result, fitted in the preview size with preview
+static void _vnr_edits_get_render_size(VnrEdits *edits, gboolean preview,
+                                       gint *width, gint *height)
+{
+    *width = edits->state.width;
+    *height = edits->state.height;
+
+    if (!preview || edits->preview_width < 1 || edits->preview_height < 1)
+        return;
+
+    const gdouble zoom = MIN(1.0, MIN(
+                        (gdouble) edits->preview_width / *width,
+                        (gdouble) edits->preview_height / *height));
+
+    // same rounding as the view's zoomed size
+    *width = MAX(1, (gint) (*width * zoom + 0.5));
+    *height = MAX(1, (gint) (*height * zoom + 0.5));
+}
+
+static GdkPixbuf* _vnr_edits_render(VnrEdits *edits, gboolean preview,
+                                    gboolean *is_shared)
+{
+    const VnrEditState *state = &edits->state;
+    const GdkRectangle *area = &state->area;
+
+    GdkPixbuf *result = gdk_pixbuf_new_subpixbuf(edits->source,
+                                                 area->x, area->y,
+                                                 area->width, area->height);
+    gboolean shared = TRUE;
+
+    gint result_width;
+    gint result_height;
+    _vnr_edits_get_render_size(edits, preview, &result_width, &result_height);
+
+    // scale before the turns, the pixels to orient are often fewer
+    gint width = (state->turns % 2) ? result_height : result_width;
+    gint height = (state->turns % 2) ? result_width : result_height;
+
+    if (result && (width != area->width || height != area->height))
+    {
+        result = _vnr_edits_replace(
+                    result,
+                    gd_pixbuf_scale_full(result, width, height,
+                                         preview ? GD_LINEAR : GD_LANCZOS3,
+                                         state->flags));
+        shared = FALSE;
+    }
+
+    if (result && (state->flip || state->turns > 0))
+    {
+        const GdkPixbufRotation angle = _vnr_edits_angles[state->turns];
+
+        // flips and half turns of scaled pixels are done in place
+        if (!shared && state->turns % 2 == 0)
+        {
+            if (!gd_pixbuf_rotate_flip_in_place(result, angle, state->flip))
+                g_clear_object(&result);
+        }
+        else
+        {
+            result = _vnr_edits_replace(
+                        result,
+                        gd_pixbuf_rotate_flip(result, angle, state->flip));
+        }
+
+        shared = FALSE;
+    }
+
+    if (result && state->has_color)
+    {
+        // in place unless the pixels are the source ones
+        GdkPixbuf *dest = result;
+
+        if (shared)
+        {
+            dest = gdk_pixbuf_new(gdk_pixbuf_get_colorspace(result),
+                                  gdk_pixbuf_get_has_alpha(result),
+                                  gdk_pixbuf_get_bits_per_sample(result),
+                                  gdk_pixbuf_get_width(result),
+                                  gdk_pixbuf_get_height(result));
+        }
+
+        if (!dest || !gd_pixbuf_color_filter(result, dest,
+                                             &state->color, NULL))
+        {
+            if (dest != result)
+                g_clear_object(&dest);
+
+            g_clear_object(&result);
+        }
+        else if (dest != result)
+        {
+            result = _vnr_edits_replace(result, dest);
+        }
+    }
+
+    *is_shared = shared;
+
+    return result;
+}
+
+// the preview of the edits from the one without the last edit, NULL if
+// it is better rendered from the source
+static GdkPixbuf* _vnr_edits_render_from(GdkPixbuf *previous,
+                                         const VnrEdit *edit,
+                                         gint width, gint height)
+{
+    GdkPixbuf *result = NULL;
+
+    // a quarter turn of a fitted preview may not fit the same way
+    const gboolean swap = edit->type == VNR_EDIT_ROTATE
+                          && (edit->angle == GDK_PIXBUF_ROTATE_CLOCKWISE
+                              || edit->angle
+                                 == GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
+
+    if (gdk_pixbuf_get_width(previous) != (swap ? height : width)
+        || gdk_pixbuf_get_height(previous) != (swap ? width : height))
+        return NULL;
+
+    switch (edit->type)
+    {
+    case VNR_EDIT_ROTATE:
+        result = gd_pixbuf_rotate_flip(previous, edit->angle, FALSE);
+        break;
+
+    case VNR_EDIT_FLIP:
+        // a vertical flip is a horizontal one and a half turn
+        result = gd_pixbuf_rotate_flip(previous,
+                                       edit->horizontal
+                                       ? GDK_PIXBUF_ROTATE_NONE
+                                       : GDK_PIXBUF_ROTATE_UPSIDEDOWN,
+                                       TRUE);
+        break;
+
+    case VNR_EDIT_COLOR:
+        result = gdk_pixbuf_new(gdk_pixbuf_get_colorspace(previous),
+                                gdk_pixbuf_get_has_alpha(previous),
+                                gdk_pixbuf_get_bits_per_sample(previous),
+                                gdk_pixbuf_get_width(previous),
+                                gdk_pixbuf_get_height(previous));
+
+        if (result && !gd_pixbuf_color_filter(previous, result,
+                                              &edit->matrix, NULL))
+            g_clear_object(&result);
+
+        break;
+
+    case VNR_EDIT_CROP:
+    case VNR_EDIT_RESIZE:
+        break;
+    }
+
+    return result;
+}
+
+/**
+ * vnr_edits_render:
+ * @edits: the edits
+ * @preview: the result fits the preview size, a faster filter is used for
+ *           the resampling and the result is cached for undo and redo
+ * @returns: a new reference on the result or %NULL.
+ *
+ * The result may share the pixels of the source when the edits only crop.
+ **/
+GdkPixbuf* vnr_edits_render(VnrEdits *edits, gboolean preview)
+{
+    const guint count = edits->list->len;
+
+    if (count == 0)
+        return g_object_ref(edits->source);
+
+    VnrEditsPreview *previous = NULL;
+
+    if (preview)
+    {
+        for (GList *item = edits->cache.head; item; item = item->next)
+        {
+            VnrEditsPreview *cached = item->data;
+
+            if (cached->count == count)
+                return g_object_ref(cached->pixbuf);
+
+            if (cached->count == count - 1)
+                previous = cached;
+        }
+    }
+
+    gboolean shared = FALSE;
+    GdkPixbuf *result = NULL;
+
+    if (previous)
+    {
+        gint width;
+        gint height;
+        _vnr_edits_get_render_size(edits, TRUE, &width, &height);
+
+        result = _vnr_edits_render_from(
+                    previous->pixbuf,
+                    &g_array_index(edits->list, VnrEdit, count - 1),
+                    width, height);
+    }
+
+    if (result == NULL)
+        result = _vnr_edits_render(edits, preview, &shared);
+
+    if (result == NULL || !preview)
+        return result;
+
+    VnrEditsPreview *cached = g_new0(VnrEditsPreview, 1);
+    cached->count = count;
+    cached->pixbuf = g_object_ref(result);
+    cached->size = shared ? 0 : gdk_pixbuf_get_byte_length(result);
+
+    g_queue_push_tail(&edits->cache, cached);
+    edits->cache_size += cached->size;
+
+    _vnr_edits_cache_trim(edits, G_MAXUINT);
+
+    return result;
+}
+
+// drops the previews of count edits or more, then the oldest ones over the
+// limit but the last one, which the next preview is made from
+static void _vnr_edits_cache_trim(VnrEdits *edits, guint count)
+{
+    GList *item = edits->cache.head;
+
+    while (item)
+    {
+        GList *next = item->next;
+        VnrEditsPreview *cached = item->data;
+
+        if (cached->count >= count
+            || (next && edits->cache_size > edits->cache_limit))
+        {
+            edits->cache_size -= cached->size;
+            g_object_unref(cached->pixbuf);
+            g_free(cached);
+
+            g_queue_delete_link(&edits->cache, item);
+        }
+
+        item = next;
+    }
+}
+
+
@@ -0,0 +1,92 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VNR_EDITS_H__
+#define __VNR_EDITS_H__
+
+#include <gtk/gtk.h>
+#include "gd-resize.h"
+#include "gd-filter.h"
+
+// Edits are recorded against the loaded image and rendered from it, the
+// geometric ones in one resampling pass and the colour ones in one per
+// pixel pass, so a sequence of edits never resamples a resampled image.
+
+typedef enum
+{
+    VNR_EDIT_ROTATE,
+    VNR_EDIT_FLIP,
+    VNR_EDIT_CROP,
+    VNR_EDIT_RESIZE,
+    VNR_EDIT_COLOR,
+
+} VnrEditType;
+
+typedef struct _VnrEdit VnrEdit;
+
+struct _VnrEdit
+{
+    VnrEditType type;
+
+    union
+    {
+        GdkPixbufRotation angle;
+        gboolean horizontal;
+        GdkRectangle area;      // in the coordinates of the current result
+
+        struct
+        {
+            gint width;
+            gint height;
+            gdScaleFlags flags;
+
+        } size;
+
+        gdColorMatrix matrix;
+    };
+};
+
+typedef struct _VnrEdits VnrEdits;
+
+VnrEdits* vnr_edits_new(GdkPixbuf *source);
+VnrEdits* vnr_edits_copy(VnrEdits *edits);
+void vnr_edits_free(VnrEdits *edits);
+
+GdkPixbuf* vnr_edits_get_source(VnrEdits *edits);
+guint vnr_edits_get_count(VnrEdits *edits);
+void vnr_edits_set_cache_limit(VnrEdits *edits, gsize limit);
+
+void vnr_edits_push(VnrEdits *edits, const VnrEdit *edit);
+gboolean vnr_edits_pop(VnrEdits *edits, VnrEdit *edit);
+gboolean vnr_edits_cancel(VnrEdits *edits);
+gboolean vnr_edits_undo(VnrEdits *edits);
+gboolean vnr_edits_redo(VnrEdits *edits);
+void vnr_edits_set_saved(VnrEdits *edits);
+gboolean vnr_edits_is_modified(VnrEdits *edits);
+void vnr_edits_get_size(VnrEdits *edits, gint *width, gint *height);
+void vnr_edits_set_preview_size(VnrEdits *edits, gint width, gint height);
+gboolean vnr_edits_compact(VnrEdits *edits);
+gboolean vnr_edits_get_lossless(VnrEdits *edits, gint orientation,
+                                gint width, gint height,
+                                GdkRectangle *area, gboolean *flip,
+                                GdkPixbufRotation *angle);
+
+GdkPixbuf* vnr_edits_render(VnrEdits *edits, gboolean preview);
+
+#endif // __VNR_EDITS_H__
+
+
@@ -0,0 +1,510 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "vnr-jpeg.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+
+/*
+    Crops and orientations of a JPEG file done on the DCT coefficients,
+    as jpegtran does: the blocks are moved, transposed for the quarter
+    turns, and the odd frequencies of a reversed axis change sign.
+
+    A reversed axis must hold whole MCUs, and a crop must start on an
+    MCU, otherwise the edge blocks would be wrong: the edits are then
+    saved by encoding the pixels again. The markers are copied as they
+    are, but the Exif orientation that was applied on load is reset.
+*/
+
+#define VNR_JPEG_EXIF_ORIENTATION 0x0112
+
+typedef struct
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+    GError **error;
+
+    // set through pointers after setjmp
+    unsigned char *output;
+    unsigned long output_size;
+
+} VnrJpegContext;
+
+typedef struct
+{
+    GdkRectangle area;      // of the stored image
+    gboolean transpose;     // destination columns are source rows
+    gboolean reverse_x;     // source columns are read from the right
+    gboolean reverse_y;     // source rows are read from the bottom
+
+} VnrJpegTransform;
+
+static void _vnr_jpeg_error_exit(j_common_ptr cinfo);
+static void _vnr_jpeg_output_message(j_common_ptr cinfo);
+static gint _vnr_jpeg_exif_orientation(jpeg_saved_marker_ptr marker,
+                                       gboolean reset);
+static gboolean _vnr_jpeg_get_transform(j_decompress_ptr src,
+                                        VnrEdits *edits,
+                                        VnrJpegTransform *transform);
+static jvirt_barray_ptr* _vnr_jpeg_request(j_decompress_ptr src,
+                                           const VnrJpegTransform *transform);
+static void _vnr_jpeg_transform_coefs(j_decompress_ptr src,
+                                      jvirt_barray_ptr *src_coefs,
+                                      jvirt_barray_ptr *dst_coefs,
+                                      const VnrJpegTransform *transform);
+static void _vnr_jpeg_copy_markers(j_decompress_ptr src,
+                                   j_compress_ptr dst);
+
+
+/**
+ * vnr_jpeg_transform:
+ * @path: the JPEG file the edits were loaded from
+ * @edits: the edits
+ * @buffer: receives the new file, to free with g_free()
+ * @buffer_size: receives its size
+ * @error: return location for an error or %NULL
+ * @returns: %TRUE if the result of the edits was written in @buffer,
+ *           %FALSE with @error unset if they can't be done losslessly.
+ **/
+gboolean vnr_jpeg_transform(const gchar *path, VnrEdits *edits,
+                            gchar **buffer, gsize *buffer_size,
+                            GError **error)
+{
+    gchar *data = NULL;
+    gsize size = 0;
+
+    if (!g_file_get_contents(path, &data, &size, error))
+        return FALSE;
+
+    struct jpeg_decompress_struct src;
+    struct jpeg_compress_struct dst;
+    VnrJpegContext context = {0};
+    volatile gboolean ret = FALSE;
+
+    src.err = jpeg_std_error(&context.pub);
+    context.pub.error_exit = _vnr_jpeg_error_exit;
+    context.pub.output_message = _vnr_jpeg_output_message;
+    context.error = error;
+    dst.err = &context.pub;
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+
+    if (setjmp(context.setjmp_buffer))
+        goto out;
+
+    jpeg_mem_src(&src, (unsigned char*) data, size);
+
+    jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+
+    for (int m = 0; m < 16; ++m)
+        jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+
+    jpeg_read_header(&src, TRUE);
+
+    VnrJpegTransform transform;
+
+    if (!_vnr_jpeg_get_transform(&src, edits, &transform))
+        goto out;
+
+    // the destination arrays are realized with the source ones
+    jvirt_barray_ptr *dst_coefs = _vnr_jpeg_request(&src, &transform);
+    jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&src);
+
+    jpeg_copy_critical_parameters(&src, &dst);
+
+    if (transform.transpose)
+    {
+        dst.image_width = transform.area.height;
+        dst.image_height = transform.area.width;
+
+        for (int ci = 0; ci < dst.num_components; ++ci)
+        {
+            jpeg_component_info *comp = &dst.comp_info[ci];
+            const int h_samp = comp->h_samp_factor;
+
+            comp->h_samp_factor = comp->v_samp_factor;
+            comp->v_samp_factor = h_samp;
+        }
+
+        // the coefficients are quantized with the tables
+        for (int t = 0; t < NUM_QUANT_TBLS; ++t)
+        {
+            JQUANT_TBL *table = dst.quant_tbl_ptrs[t];
+
+            if (table == NULL)
+                continue;
+
+            for (int v = 0; v < DCTSIZE; ++v)
+            {
+                for (int u = v + 1; u < DCTSIZE; ++u)
+                {
+                    const UINT16 tmp = table->quantval[v * DCTSIZE + u];
+
+                    table->quantval[v * DCTSIZE + u] =
+                                        table->quantval[u * DCTSIZE + v];
+                    table->quantval[u * DCTSIZE + v] = tmp;
+                }
+            }
+        }
+    }
+    else
+    {
+        dst.image_width = transform.area.width;
+        dst.image_height = transform.area.height;
+    }
+
+    if (jpeg_has_multiple_scans(&src))
+        jpeg_simple_progression(&dst);
+
+    dst.optimize_coding = TRUE;
+
+    _vnr_jpeg_transform_coefs(&src, src_coefs, dst_coefs, &transform);
+
+    jpeg_mem_dest(&dst, &context.output, &context.output_size);
+    jpeg_write_coefficients(&dst, dst_coefs);
+    _vnr_jpeg_copy_markers(&src, &dst);
+
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+
+    // allocated with malloc by the library
+    *buffer = g_malloc(context.output_size);
+    *buffer_size = context.output_size;
+    memcpy(*buffer, context.output, context.output_size);
+
+    ret = TRUE;
+
+out:
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+
+    free(context.output);
+    g_free(data);
+
+    return ret;
+}
+
+static void _vnr_jpeg_error_exit(j_common_ptr cinfo)
+{
+    VnrJpegContext *context = (VnrJpegContext*) cinfo->err;
+    char buffer[JMSG_LENGTH_MAX];
+
+    cinfo->err->format_message(cinfo, buffer);
+
+    g_set_error(context->error,
+                GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                _("Error interpreting JPEG image file (%s)"), buffer);
+
+    longjmp(context->setjmp_buffer, 1);
+}
+
+static void _vnr_jpeg_output_message(j_common_ptr cinfo)
+{
+    // warnings are ignored like when loading
+    (void) cinfo;
+}
+
+
+// markers --------------------------------------------------------------------
+
+static guint _vnr_jpeg_get16(const JOCTET *p, gboolean big_endian)
+{
+    return big_endian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+static guint32 _vnr_jpeg_get32(const JOCTET *p, gboolean big_endian)
+{
+    return big_endian
+            ? ((guint32) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3])
+            : ((guint32) p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0]);
+}
+
+// the orientation of the first IFD of an Exif marker, 0 if none
+static gint _vnr_jpeg_exif_orientation(jpeg_saved_marker_ptr marker,
+                                       gboolean reset)
+{
+    if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14
+        || memcmp(marker->data, "Exif\0\0", 6) != 0)
+    {
+        return 0;
+    }
+
+    JOCTET *tiff = marker->data + 6;
+    const guint size = marker->data_length - 6;
+    gboolean big_endian;
+
+    if (tiff[0] == 'M' && tiff[1] == 'M')
+        big_endian = TRUE;
+    else if (tiff[0] == 'I' && tiff[1] == 'I')
+        big_endian = FALSE;
+    else
+        return 0;
+
+    const guint32 ifd = _vnr_jpeg_get32(tiff + 4, big_endian);
+
+    if (ifd > size - 2)
+        return 0;
+
+    const guint count = _vnr_jpeg_get16(tiff + ifd, big_endian);
+
+    for (guint i = 0; i < count; ++i)
+    {
+        const guint64 entry = (guint64) ifd + 2 + 12 * i;
+
+        if (entry + 12 > size)
+            return 0;
+
+        JOCTET *p = tiff + entry;
+
+        if (_vnr_jpeg_get16(p, big_endian) != VNR_JPEG_EXIF_ORIENTATION)
+            continue;
+
+        const gint orientation = _vnr_jpeg_get16(p + 8, big_endian);
+
+        if (reset)
+        {
+            p[8] = big_endian ? 0 : 1;
+            p[9] = big_endian ? 1 : 0;
+        }
+
+        return orientation;
+    }
+
+    return 0;
+}
+
+static void _vnr_jpeg_copy_markers(j_decompress_ptr src, j_compress_ptr dst)
+{
+    for (jpeg_saved_marker_ptr marker = src->marker_list;
+         marker != NULL;
+         marker = marker->next)
+    {
+        // written by the library
+        if (dst->write_JFIF_header && marker->marker == JPEG_APP0
+            && marker->data_length >= 5
+            && memcmp(marker->data, "JFIF\0", 5) == 0)
+        {
+            continue;
+        }
+
+        if (dst->write_Adobe_marker && marker->marker == JPEG_APP0 + 14
+            && marker->data_length >= 5
+            && memcmp(marker->data, "Adobe", 5) == 0)
+        {
+            continue;
+        }
+
+        // the pixels are now in the orientation that was shown
+        _vnr_jpeg_exif_orientation(marker, TRUE);
+
+        jpeg_write_marker(dst, marker->marker,
+                          marker->data, marker->data_length);
+    }
+}
+
+
+// coefficients ---------------------------------------------------------------
+
+static JDIMENSION _vnr_jpeg_div_round_up(JDIMENSION a, JDIMENSION b)
+{
+    return (a + b - 1) / b;
+}
+
+static gboolean _vnr_jpeg_get_transform(j_decompress_ptr src,
+                                        VnrEdits *edits,
+                                        VnrJpegTransform *transform)
+{
+    gint orientation = 0;
+
+    for (jpeg_saved_marker_ptr marker = src->marker_list;
+         marker != NULL && orientation == 0;
+         marker = marker->next)
+    {
+        orientation = _vnr_jpeg_exif_orientation(marker, FALSE);
+    }
+
+    GdkRectangle *area = &transform->area;
+    gboolean flip;
+    GdkPixbufRotation angle;
+
+    if (!vnr_edits_get_lossless(edits, orientation,
+                                src->image_width, src->image_height,
+                                area, &flip, &angle))
+    {
+        return FALSE;
+    }
+
+    // source axes read backwards, see gd-rotate.c
+    gint turns = 0;
+
+    if (angle == GDK_PIXBUF_ROTATE_CLOCKWISE)
+        turns = 1;
+    else if (angle == GDK_PIXBUF_ROTATE_UPSIDEDOWN)
+        turns = 2;
+    else if (angle == GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE)
+        turns = 3;
+
+    transform->transpose = (turns % 2);
+    transform->reverse_x = (flip != (turns >= 2));
+    transform->reverse_y = (turns == 1 || turns == 2);
+
+    const gint mcu_width = src->max_h_samp_factor * DCTSIZE;
+    const gint mcu_height = src->max_v_samp_factor * DCTSIZE;
+
+    if (area->x % mcu_width || area->y % mcu_height)
+        return FALSE;
+
+    if (transform->reverse_x && area->width % mcu_width)
+        return FALSE;
+
+    if (transform->reverse_y && area->height % mcu_height)
+        return FALSE;
+
+    return TRUE;
+}
+
+static jvirt_barray_ptr* _vnr_jpeg_request(j_decompress_ptr src,
+                                           const VnrJpegTransform *transform)
+{
+    const GdkRectangle *area = &transform->area;
+    const JDIMENSION mcu_cols = _vnr_jpeg_div_round_up(
+                        area->width, src->max_h_samp_factor * DCTSIZE);
+    const JDIMENSION mcu_rows = _vnr_jpeg_div_round_up(
+                        area->height, src->max_v_samp_factor * DCTSIZE);
+
+    jvirt_barray_ptr *coefs = (jvirt_barray_ptr*) src->mem->alloc_small(
+                        (j_common_ptr) src, JPOOL_IMAGE,
+                        sizeof(jvirt_barray_ptr) * src->num_components);
+
+    for (int ci = 0; ci < src->num_components; ++ci)
+    {
+        const jpeg_component_info *comp = &src->comp_info[ci];
+
+        // whole MCUs of the area, transposed with the sampling factors
+        JDIMENSION width = mcu_cols * comp->h_samp_factor;
+        JDIMENSION height = mcu_rows * comp->v_samp_factor;
+        int access = comp->v_samp_factor;
+
+        if (transform->transpose)
+        {
+            JDIMENSION tmp = width;
+            width = height;
+            height = tmp;
+
+            access = comp->h_samp_factor;
+        }
+
+        coefs[ci] = src->mem->request_virt_barray(
+                                (j_common_ptr) src, JPOOL_IMAGE, FALSE,
+                                width, height, access);
+    }
+
+    return coefs;
+}
+
+static void _vnr_jpeg_copy_block(JCOEFPTR dst, const JCOEF *src,
+                                 const VnrJpegTransform *transform)
+{
+    for (int v = 0; v < DCTSIZE; ++v)
+    {
+        for (int u = 0; u < DCTSIZE; ++u)
+        {
+            const int su = transform->transpose ? v : u;
+            const int sv = transform->transpose ? u : v;
+
+            JCOEF coef = src[sv * DCTSIZE + su];
+
+            // a reversed axis changes the sign of its odd frequencies
+            if ((transform->reverse_x && (su & 1))
+                != (transform->reverse_y && (sv & 1)))
+            {
+                coef = -coef;
+            }
+
+            dst[v * DCTSIZE + u] = coef;
+        }
+    }
+}
+
+static void _vnr_jpeg_transform_coefs(j_decompress_ptr src,
+                                      jvirt_barray_ptr *src_coefs,
+                                      jvirt_barray_ptr *dst_coefs,
+                                      const VnrJpegTransform *transform)
+{
+    const GdkRectangle *area = &transform->area;
+    const int mcu_width = src->max_h_samp_factor * DCTSIZE;
+    const int mcu_height = src->max_v_samp_factor * DCTSIZE;
+
+    for (int ci = 0; ci < src->num_components; ++ci)
+    {
+        const jpeg_component_info *comp = &src->comp_info[ci];
+        const int h_samp = comp->h_samp_factor;
+        const int v_samp = comp->v_samp_factor;
+
+        // in blocks of the component, the area is exact when reversed
+        const JDIMENSION x0 = area->x / mcu_width * h_samp;
+        const JDIMENSION y0 = area->y / mcu_height * v_samp;
+        const JDIMENSION width = _vnr_jpeg_div_round_up(
+                                    area->width, mcu_width) * h_samp;
+        const JDIMENSION height = _vnr_jpeg_div_round_up(
+                                    area->height, mcu_height) * v_samp;
+
+        const JDIMENSION src_cols = _vnr_jpeg_div_round_up(
+                                    comp->width_in_blocks, h_samp) * h_samp;
+        const JDIMENSION src_rows = _vnr_jpeg_div_round_up(
+                                    comp->height_in_blocks, v_samp) * v_samp;
+
+        const JDIMENSION dst_cols = transform->transpose ? height : width;
+        const JDIMENSION dst_rows = transform->transpose ? width : height;
+
+        for (JDIMENSION y = 0; y < dst_rows; ++y)
+        {
+            JBLOCKROW dst_row = src->mem->access_virt_barray(
+                            (j_common_ptr) src, dst_coefs[ci], y, 1, TRUE)[0];
+
+            for (JDIMENSION x = 0; x < dst_cols; ++x)
+            {
+                const JDIMENSION a = transform->transpose ? y : x;
+                const JDIMENSION b = transform->transpose ? x : y;
+                const JDIMENSION sx = x0 + (transform->reverse_x
+                                            ? width - 1 - a : a);
+                const JDIMENSION sy = y0 + (transform->reverse_y
+                                            ? height - 1 - b : b);
+
+                // the padding of a partial MCU at the end of the image
+                if (sx >= src_cols || sy >= src_rows)
+                {
+                    memset(dst_row[x], 0, sizeof(JBLOCK));
+                    continue;
+                }
+
+                JBLOCKROW src_row = src->mem->access_virt_barray(
+                        (j_common_ptr) src, src_coefs[ci], sy, 1, FALSE)[0];
+
+                _vnr_jpeg_copy_block(dst_row[x], src_row[sx], transform);
+            }
+        }
+    }
+}
+
+
@@ -0,0 +1,422 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "vnr-png.h"
+
+#include "gd-resize.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/*
+    PNG encoder deflating on all the cores, as pigz does: the rows are
+    filtered in parallel, then the filtered data is cut in chunks which
+    are deflated independently, each primed with the last 32 KiB of the
+    data before it, so that matches may still reach back across chunks.
+
+    A chunk that isn't the last ends with a sync flush, on a byte
+    boundary, so that the raw deflate streams can be concatenated. The
+    zlib header and the Adler-32 of the whole data, combined from the
+    ones of the chunks, make them a single valid IDAT stream.
+*/
+
+#define VNR_PNG_CHUNK_BYTES (256 * 1024)
+#define VNR_PNG_WINDOW_BYTES 32768
+#define VNR_PNG_IDAT_BYTES (1024 * 1024)
+
+typedef struct
+{
+    // filtered rows, each starting with its filter type
+    guint8 *data;
+    gsize size;
+    gsize row_bytes;        // without the filter type byte
+
+    const guint8 *pixels;
+    int rowstride;
+    int bpp;
+    int level;
+
+    // deflated chunks
+    guint8 **chunks;
+    gsize *chunk_sizes;
+    uLong *adlers;
+    gint failed;            // atomic
+
+} VnrPngJob;
+
+
+// filter ---------------------------------------------------------------------
+
+static inline guint8 _vnr_png_paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+
+    return pb <= pc ? b : c;
+}
+
+static gsize _vnr_png_filter_row(const guint8 *row, const guint8 *prev,
+                                 guint8 *out, gsize row_bytes, int bpp,
+                                 int type)
+{
+    // returns the sum of the filtered bytes taken as signed, the smaller
+    // the sum the better the row usually compresses
+    gsize sum = 0;
+    gsize x = 0;
+
+    switch (type)
+    {
+    case 1:
+        for (; x < (gsize) bpp; ++x)
+            out[x] = row[x];
+        for (; x < row_bytes; ++x)
+            out[x] = row[x] - row[x - bpp];
+        break;
+
+    case 2:
+        for (; x < row_bytes; ++x)
+            out[x] = row[x] - (prev ? prev[x] : 0);
+        break;
+
+    case 3:
+        for (; x < (gsize) bpp; ++x)
+            out[x] = row[x] - ((prev ? prev[x] : 0) >> 1);
+        for (; x < row_bytes; ++x)
+            out[x] = row[x] - ((row[x - bpp] + (prev ? prev[x] : 0)) >> 1);
+        break;
+
+    case 4:
+        // without a previous row Paeth predicts the left byte
+        if (!prev)
+            return _vnr_png_filter_row(row, prev, out, row_bytes, bpp, 1);
+
+        for (; x < (gsize) bpp; ++x)
+            out[x] = row[x] - prev[x];
+        for (; x < row_bytes; ++x)
+        {
+            out[x] = row[x] - _vnr_png_paeth(row[x - bpp], prev[x],
+                                             prev[x - bpp]);
+        }
+        break;
+
+    default:
+        memcpy(out, row, row_bytes);
+        break;
+    }
+
+    for (x = 0; x < row_bytes; ++x)
+        sum += abs((gint8) out[x]);
+
+    return sum;
+}
+
+static void _vnr_png_filter_lines(void *data,
+                                  unsigned int start, unsigned int end)
+{
+    VnrPngJob *job = data;
+
+    const gsize line = job->row_bytes + 1;
+    guint8 *scratch = NULL;
+
+    // without compression the rows are stored as they are
+    if (job->level > 0)
+    {
+        scratch = malloc(job->row_bytes);
+
+        if (!scratch)
+        {
+            g_atomic_int_set(&job->failed, 1);
+            return;
+        }
+    }
+
+    for (unsigned int y = start; y < end; ++y)
+    {
+        const guint8 *row = job->pixels + (gsize) y * job->rowstride;
+        const guint8 *prev = y > 0 ? row - job->rowstride : NULL;
+        guint8 *out = job->data + y * line;
+
+        out[0] = 0;
+        gsize best = _vnr_png_filter_row(row, prev, out + 1,
+                                         job->row_bytes, job->bpp, 0);
+
+        if (!scratch)
+            continue;
+
+        // the adaptive heuristic of libpng, smallest sum of the 5 types
+        for (int type = 1; type <= 4; ++type)
+        {
+            gsize sum = _vnr_png_filter_row(row, prev, scratch,
+                                            job->row_bytes, job->bpp, type);
+            if (sum < best)
+            {
+                best = sum;
+                out[0] = type;
+                memcpy(out + 1, scratch, job->row_bytes);
+            }
+        }
+    }
+
+    free(scratch);
+}
+
+
+// deflate --------------------------------------------------------------------
+
+static gboolean _vnr_png_deflate_chunk(VnrPngJob *job, unsigned int i,
+                                       unsigned int num_chunks)
+{
+    const gsize offset = (gsize) i * VNR_PNG_CHUNK_BYTES;
+    const gsize size = MIN(VNR_PNG_CHUNK_BYTES, job->size - offset);
+    const gboolean last = (i == num_chunks - 1);
+
+    z_stream stream = {0};
+
+    if (deflateInit2(&stream, job->level, Z_DEFLATED, -MAX_WBITS, 8,
+                     job->level > 0 ? Z_FILTERED : Z_DEFAULT_STRATEGY)
+        != Z_OK)
+        return false;
+
+    if (offset > 0)
+    {
+        gsize dict = MIN(offset, VNR_PNG_WINDOW_BYTES);
+
+        deflateSetDictionary(&stream, job->data + offset - dict, dict);
+    }
+
+    // room for the sync flush marker
+    gsize capacity = deflateBound(&stream, size) + 16;
+    guint8 *out = malloc(capacity);
+
+    if (!out)
+    {
+        deflateEnd(&stream);
+        return false;
+    }
+
+    stream.next_in = job->data + offset;
+    stream.avail_in = size;
+    stream.next_out = out;
+    stream.avail_out = capacity;
+
+    int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+    gboolean done = last ? ret == Z_STREAM_END
+                         : ret == Z_OK && stream.avail_in == 0
+                           && stream.avail_out > 0;
+
+    job->chunks[i] = out;
+    job->chunk_sizes[i] = stream.total_out;
+    job->adlers[i] = adler32(adler32(0, NULL, 0),
+                             job->data + offset, size);
+
+    deflateEnd(&stream);
+
+    return done;
+}
+
+static void _vnr_png_deflate_lines(void *data,
+                                   unsigned int start, unsigned int end)
+{
+    VnrPngJob *job = data;
+
+    const unsigned int num_chunks = (job->size + VNR_PNG_CHUNK_BYTES - 1)
+                                    / VNR_PNG_CHUNK_BYTES;
+
+    for (unsigned int i = start; i < end; ++i)
+    {
+        if (!_vnr_png_deflate_chunk(job, i, num_chunks))
+            g_atomic_int_set(&job->failed, 1);
+    }
+}
+
+
+// file -----------------------------------------------------------------------
+
+static void _vnr_png_put_uint32(GByteArray *out, guint32 value)
+{
+    guint8 bytes[4] = {value >> 24, value >> 16, value >> 8, value};
+
+    g_byte_array_append(out, bytes, 4);
+}
+
+static void _vnr_png_put_chunk(GByteArray *out, const gchar *type,
+                               const guint8 *data, gsize size)
+{
+    _vnr_png_put_uint32(out, size);
+    g_byte_array_append(out, (const guint8*) type, 4);
+
+    if (size > 0)
+        g_byte_array_append(out, data, size);
+
+    uLong crc = crc32(0, (const Bytef*) type, 4);
+
+    // crc32() would return its initial value for a NULL buffer
+    if (size > 0)
+        crc = crc32(crc, data, size);
+
+    _vnr_png_put_uint32(out, crc);
+}
+
+static void _vnr_png_put_idat(GByteArray *out, VnrPngJob *job,
+                              unsigned int num_chunks)
+{
+    // the zlib stream, as deflate() would have written it
+    int flags = job->level < 2 ? 0 : job->level < 6 ? 1
+                                   : job->level == 6 ? 2 : 3;
+    guint header = (Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8 | flags << 6;
+    header += 31 - header % 31;
+
+    uLong adler = job->adlers[0];
+    gsize stream_size = 2 + 4;
+
+    for (unsigned int i = 0; i < num_chunks; ++i)
+    {
+        stream_size += job->chunk_sizes[i];
+
+        if (i > 0)
+        {
+            gsize offset = (gsize) i * VNR_PNG_CHUNK_BYTES;
+            gsize size = MIN(VNR_PNG_CHUNK_BYTES, job->size - offset);
+
+            adler = adler32_combine(adler, job->adlers[i], size);
+        }
+    }
+
+    guint8 *stream = g_malloc(stream_size);
+    guint8 *p = stream;
+
+    *p++ = header >> 8;
+    *p++ = header & 0xff;
+
+    for (unsigned int i = 0; i < num_chunks; ++i)
+    {
+        memcpy(p, job->chunks[i], job->chunk_sizes[i]);
+        p += job->chunk_sizes[i];
+    }
+
+    *p++ = adler >> 24;
+    *p++ = adler >> 16;
+    *p++ = adler >> 8;
+    *p++ = adler;
+
+    for (gsize offset = 0; offset < stream_size;
+         offset += VNR_PNG_IDAT_BYTES)
+    {
+        _vnr_png_put_chunk(out, "IDAT", stream + offset,
+                           MIN(VNR_PNG_IDAT_BYTES, stream_size - offset));
+    }
+
+    g_free(stream);
+}
+
+/**
+ * vnr_png_save_to_buffer:
+ * @pixbuf: an 8 bits RGB or RGBA pixbuf
+ * @compression: the zlib level, from 0 to 9
+ * @buffer: receives the PNG file, to free with g_free()
+ * @buffer_size: receives its size
+ * @error: return location for an error or %NULL
+ * @returns: %TRUE if the file was written in @buffer, %FALSE with
+ *           @error unset if the pixbuf layout isn't supported.
+ **/
+gboolean vnr_png_save_to_buffer(GdkPixbuf *pixbuf, gint compression,
+                                gchar **buffer, gsize *buffer_size,
+                                GError **error)
+{
+    if (gdk_pixbuf_get_colorspace(pixbuf) != GDK_COLORSPACE_RGB
+        || gdk_pixbuf_get_bits_per_sample(pixbuf) != 8)
+        return false;
+
+    const int width = gdk_pixbuf_get_width(pixbuf);
+    const int height = gdk_pixbuf_get_height(pixbuf);
+    const int n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+
+    VnrPngJob job = {0};
+    job.pixels = gdk_pixbuf_read_pixels(pixbuf);
+    job.rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    job.bpp = n_channels;
+    job.level = CLAMP(compression, 0, 9);
+    job.row_bytes = (gsize) width * n_channels;
+    job.size = (job.row_bytes + 1) * height;
+
+    const unsigned int num_chunks = (job.size + VNR_PNG_CHUNK_BYTES - 1)
+                                    / VNR_PNG_CHUNK_BYTES;
+
+    job.data = malloc(job.size);
+    job.chunks = g_new0(guint8*, num_chunks);
+    job.chunk_sizes = g_new0(gsize, num_chunks);
+    job.adlers = g_new0(uLong, num_chunks);
+
+    gboolean ret = job.data
+                   && gd_run_lines(height, 2 * (job.row_bytes + 1),
+                                   _vnr_png_filter_lines, &job)
+                   && !job.failed
+                   && gd_run_lines(num_chunks, VNR_PNG_CHUNK_BYTES,
+                                   _vnr_png_deflate_lines, &job)
+                   && !job.failed;
+
+    if (ret)
+    {
+        static const guint8 signature[8] = {
+            0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+        };
+
+        GByteArray *out = g_byte_array_new();
+        g_byte_array_append(out, signature, 8);
+
+        guint8 ihdr[13] = {
+            width >> 24, width >> 16, width >> 8, width,
+            height >> 24, height >> 16, height >> 8, height,
+            8,                          // bit depth
+            n_channels == 4 ? 6 : 2,    // RGBA or RGB
+            0, 0, 0                     // deflate, adaptive, no interlace
+        };
+        _vnr_png_put_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+        _vnr_png_put_idat(out, &job, num_chunks);
+        _vnr_png_put_chunk(out, "IEND", NULL, 0);
+
+        *buffer_size = out->len;
+        *buffer = (gchar*) g_byte_array_free(out, FALSE);
+    }
+    else
+    {
+        g_set_error_literal(error, GDK_PIXBUF_ERROR,
+                            GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                            _("Not enough virtual memory."));
+    }
+
+    for (unsigned int i = 0; i < num_chunks; ++i)
+        free(job.chunks[i]);
+
+    g_free(job.chunks);
+    g_free(job.chunk_sizes);
+    g_free(job.adlers);
+    free(job.data);
+
+    return ret;
+}
+
+
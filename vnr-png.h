@@ -0,0 +1,29 @@
+/*
+ * This file is part of ImgView.
+ *
+ * ImgView is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ImgView is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ImgView.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VNR_PNG_H__
+#define __VNR_PNG_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+gboolean vnr_png_save_to_buffer(GdkPixbuf *pixbuf, gint compression,
+                                gchar **buffer, gsize *buffer_size,
+                                GError **error);
+
+#endif // __VNR_PNG_H__
+
+
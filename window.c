@@ -25,6 +25,9 @@
 #include "uni-anim-view.h"
 #include "uni-utils.h"
 #include "vnr-tools.h"
+#include "vnr-edits.h"
+#include "vnr-jpeg.h"
+#include "vnr-png.h"
 #include "uni-exiv2.hpp"
 
 #include "message-area.h"
@@ -33,11 +36,15 @@
 #include "vnr-properties.h"
 #include "vnr-resize.h"
 #include "gd-resize.h"
+#include "gd-filter.h"
 
 #include <etkaction.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
-#include <assert.h>
 
 // Timeout to hide the toolbar in fullscreen mode
 #define FULLSCREEN_TIMEOUT 1000
@@ -45,11 +52,48 @@
 
 G_DEFINE_TYPE(VnrWindow, window, GTK_TYPE_WINDOW)
 
+// Decoded neighbour image, with its static image already scaled at the
+// size it will be displayed when fitting is enabled. The tag identifies
+// the file that was decoded, it's compared again when the image is opened.
+typedef struct _WindowPrefetch
+{
+    gchar *path;
+    gchar *tag;
+
+    int width;
+    int height;
+    UniFittingMode fitting;
+    GdkInterpType interp;
+
+    GdkPixbufAnimation *anim;
+    GdkPixbuf *scaled;
+    gdouble zoom;
+
+} WindowPrefetch;
+
+static void _window_prefetch_free(WindowPrefetch *prefetch)
+{
+    if (!prefetch)
+        return;
+
+    g_free(prefetch->path);
+    g_free(prefetch->tag);
+
+    if (prefetch->anim)
+        g_object_unref(prefetch->anim);
+
+    if (prefetch->scaled)
+        g_object_unref(prefetch->scaled);
+
+    g_free(prefetch);
+}
+
 // creation / destruction -----------------------------------------------------
 
 static void _window_on_realize(VnrWindow *window, gpointer user_data);
 static gboolean _window_on_delete(VnrWindow *window, GdkEvent *event,
                                   gpointer data);
+static gboolean _window_quit(VnrWindow *window);
 static void window_dispose(GObject *object);
 static void window_finalize(GObject *object);
 
@@ -57,6 +101,7 @@ static void window_finalize(GObject *object);
 
 static void _window_override_background_color(VnrWindow *window,
                                               GdkRGBA *color);
+static gsize _window_get_undo_memory(VnrWindow *window);
 
 // dnd ------------------------------------------------------------------------
 
@@ -107,6 +152,15 @@ static void _on_openwith(VnrWindow *window, gpointer user_data);
 // actions --------------------------------------------------------------------
 
 static gboolean _window_on_sl_timeout(VnrWindow *window);
+static void _window_prefetch_start(VnrWindow *window);
+static void _window_prefetch_cancel(VnrWindow *window);
+static void _window_prefetch_thread(GTask *task, gpointer source_object,
+                                    gpointer task_data,
+                                    GCancellable *cancellable);
+static void _window_prefetch_ready(GObject *source_object,
+                                   GAsyncResult *result,
+                                   gpointer user_data);
+static gchar* _window_file_get_tag(const gchar *path);
 static void _window_action_reload(VnrWindow *window, GtkWidget *widget);
 static void _window_action_resetdir(VnrWindow *window, GtkWidget *widget);
 static void _window_action_selectdir(VnrWindow *window, GtkWidget *widget);
@@ -134,8 +188,6 @@ static void _window_action_preferences(VnrWindow *window, GtkWidget *widget);
 
 static void _window_action_help(VnrWindow *window, GtkWidget *widget);
 static void _window_action_test(VnrWindow *window);
-static GdkPixbuf* _window_pixbuf_new(VnrWindow *window);
-
 // private Actions ------------------------------------------------------------
 
 static void _window_rotate_pixbuf(VnrWindow *window, GdkPixbufRotation angle);
@@ -144,8 +196,14 @@ static void _window_action_crop(VnrWindow *window, GtkWidget *widget);
 static void _window_action_resize(VnrWindow *window, GtkWidget *widget);
 static void _window_filter_grayscale(VnrWindow *window, GtkWidget *widget);
 static void _window_filter_sepia(VnrWindow *window, GtkWidget *widget);
-static void _filter_transform(GdkPixbuf *src_pixbuf, GdkPixbuf *dest_pixbuf,
-                              const float mat[4][4]);
+static void _window_filter_color(VnrWindow *window,
+                                 const gdColorMatrix *mat);
+static gboolean _window_can_edit(VnrWindow *window);
+static gboolean _window_edits_push(VnrWindow *window, const VnrEdit *edit);
+static gboolean _window_edits_show(VnrWindow *window);
+static void _window_action_undo(VnrWindow *window, GtkWidget *widget);
+static void _window_action_redo(VnrWindow *window, GtkWidget *widget);
+static void _window_edits_clear(VnrWindow *window);
 static void _window_view_set_static(VnrWindow *window, GdkPixbuf *pixbuf);
 
 // ----------------------------------------------------------------------------
@@ -211,6 +269,8 @@ typedef enum
     WINDOW_ACTION_PREFERENCES,
     WINDOW_ACTION_DUPLICATE,
     WINDOW_ACTION_SAVE,
+    WINDOW_ACTION_UNDO,
+    WINDOW_ACTION_REDO,
     WINDOW_ACTION_RELOAD,
     WINDOW_ACTION_FULLSCREEN,
     WINDOW_ACTION_SLIDESHOW,
@@ -357,6 +417,20 @@ static EtkActionEntry _window_actions[] =
      NULL,
      G_CALLBACK(_window_action_save_image)},
 
+    {WINDOW_ACTION_UNDO,
+     "<Actions>/AppWindow/Undo", "<Control>Z",
+     0, NULL,
+     NULL,
+     NULL,
+     G_CALLBACK(_window_action_undo)},
+
+    {WINDOW_ACTION_REDO,
+     "<Actions>/AppWindow/Redo", "<Control>Y",
+     0, NULL,
+     NULL,
+     NULL,
+     G_CALLBACK(_window_action_redo)},
+
     {WINDOW_ACTION_RELOAD,
      "<Actions>/AppWindow/Reload", "F5",
      0, NULL,
@@ -417,25 +491,6 @@ static void _window_action_test(VnrWindow *window)
 {
 }
 
-static GdkPixbuf* _window_pixbuf_new(VnrWindow *window)
-{
-    if (!window->can_edit)
-        return NULL;
-
-    GdkPixbuf *src_pixbuf = uni_image_view_get_pixbuf(
-                                        UNI_IMAGE_VIEW(window->view));
-
-    int width = gdk_pixbuf_get_width(src_pixbuf);
-    int height = gdk_pixbuf_get_height(src_pixbuf);
-
-    return gdk_pixbuf_new(gdk_pixbuf_get_colorspace(src_pixbuf),
-                          gdk_pixbuf_get_has_alpha(src_pixbuf),
-                          gdk_pixbuf_get_bits_per_sample(src_pixbuf),
-                          width,
-                          height);
-}
-
-
 // creation / destruction -----------------------------------------------------
 
 VnrWindow* window_new()
@@ -734,9 +789,23 @@ static gboolean _window_on_delete(VnrWindow *window, GdkEvent *event,
 
     vnr_prefs_save(window->prefs);
 
-    gtk_main_quit();
+    return _window_quit(window);
+}
+
+// quits now or once the saves running are written, returns TRUE if it waits
+static gboolean _window_quit(VnrWindow *window)
+{
+    if (window->saving == 0)
+    {
+        gtk_main_quit();
+        return false;
+    }
+
+    // the temporary files would be left behind and the images not saved
+    window->quit_on_saved = true;
+    gtk_widget_hide(GTK_WIDGET(window));
 
-    return false;
+    return true;
 }
 
 static void window_dispose(GObject *object)
@@ -744,6 +813,7 @@ static void window_dispose(GObject *object)
     VnrWindow *window = VNR_WINDOW(object);
 
     _window_set_monitor(window, NULL);
+    _window_prefetch_cancel(window);
     window->accel_group = etk_actions_dispose(GTK_WINDOW(window),
                                               window->accel_group);
     window->group_image = etk_widget_list_free(window->group_image);
@@ -756,6 +826,8 @@ static void window_finalize(GObject *object)
     VnrWindow *window = VNR_WINDOW(object);
 
     g_free(window->destdir);
+    g_free(window->saved_tag);
+    _window_edits_clear(window);
     vnr_list_free(window->filelist);
     window_list_set_current(window, NULL);
 
@@ -798,6 +870,17 @@ void window_preferences_apply(VnrWindow *window)
                         (gdouble) window->prefs->sl_timeout);
         }
     }
+
+    if (window->edits)
+    {
+        vnr_edits_set_cache_limit(window->edits,
+                                  _window_get_undo_memory(window));
+    }
+}
+
+static gsize _window_get_undo_memory(VnrWindow *window)
+{
+    return (gsize) MAX(0, window->prefs->undo_memory) << 20;
 }
 
 static void _window_override_background_color(VnrWindow *window,
@@ -968,7 +1051,7 @@ static gint _window_on_key_press(GtkWidget *widget, GdkEventKey *event)
         if (window->mode != WINDOW_MODE_NORMAL)
             _window_unfullscreen(window);
         else
-            gtk_main_quit();
+            _window_quit(window);
         break;
 
     case GDK_KEY_space:
@@ -1048,6 +1131,14 @@ static void _view_on_zoom_changed(UniImageView *view, VnrWindow *window)
     gint total = 0;
     gint position = vnr_list_get_position(window->filelist, &total);
 
+    // relative to the image, an edit preview may be smaller
+    gdouble zoom = view->zoom;
+    GdkPixbuf *pixbuf = uni_image_view_get_pixbuf(view);
+
+    if (pixbuf && window->current_image_width > 0)
+        zoom *= (gdouble) gdk_pixbuf_get_width(pixbuf)
+                / window->current_image_width;
+
     char *buf = g_strdup_printf("%s%s - %i/%i - %ix%i - %i%%",
                                 (window->modified) ? "*" : "",
                                 current->display_name,
@@ -1055,7 +1146,7 @@ static void _view_on_zoom_changed(UniImageView *view, VnrWindow *window)
                                 total,
                                 window->current_image_width,
                                 window->current_image_height,
-                                (int) (view->zoom * 100.));
+                                (int) (zoom * 100.));
 
     gtk_window_set_title(GTK_WINDOW(window), buf);
 
@@ -1155,28 +1246,45 @@ static void _window_monitor_on_change(VnrWindow *window,
                                       GFileMonitor *monitor)
 {
     (void) monitor;
-    (void) other_file;
 
-    if (!window_get_current_file(window))
+    VnrFile *current = window_get_current_file(window);
+    if (!current)
         return;
 
+    GFile *changed = NULL;
+
     switch (event_type)
     {
     case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
-        char *path = g_file_get_path(event_file);
-        printf("_window_monitor_on_change: %s\n", path);
-        g_free(path);
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+        changed = event_file;
+        break;
 
-        if (!window->need_reload)
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        // a file saved atomically is renamed over the current one
+        if (other_file)
         {
-            window->need_reload = true;
-            g_idle_add((GSourceFunc) _window_on_idle_reload, window);
+            char *path = g_file_get_path(other_file);
+
+            if (g_strcmp0(path, current->path) == 0)
+                changed = other_file;
+
+            g_free(path);
         }
         break;
 
     default:
         break;
     }
+
+    if (!changed)
+        return;
+
+    if (!window->need_reload)
+    {
+        window->need_reload = true;
+        g_idle_add((GSourceFunc) _window_on_idle_reload, window);
+    }
 }
 
 static gboolean _window_on_idle_reload(VnrWindow *window)
@@ -1185,11 +1293,20 @@ static gboolean _window_on_idle_reload(VnrWindow *window)
 
     window->need_reload = false;
 
-    if (window->no_reload)
+    // the save reloads the image itself once done
+    if (window->save)
+        return G_SOURCE_REMOVE;
+
+    VnrFile *current = window_get_current_file(window);
+
+    if (current && window->saved_tag)
     {
-        window->no_reload = false;
+        gchar *tag = _window_file_get_tag(current->path);
+        gboolean saved = (g_strcmp0(tag, window->saved_tag) == 0);
+        g_free(tag);
 
-        return G_SOURCE_REMOVE;
+        if (saved)
+            return G_SOURCE_REMOVE;
     }
 
     printf("_window_on_idle_reload: reload\n");
@@ -1440,8 +1557,40 @@ gboolean window_load_file(VnrWindow *window)
     _window_update_fs_filename_label(window);
 
     GError *error = NULL;
-    GdkPixbufAnimation *pixbuf =
-            gdk_pixbuf_animation_new_from_file(current->path, &error);
+    GdkPixbufAnimation *pixbuf = NULL;
+    WindowPrefetch *prefetch = window->prefetch;
+
+    gboolean reuse = prefetch
+                     && g_strcmp0(prefetch->path, current->path) == 0;
+
+    if (reuse)
+    {
+        // the file may have been replaced since it was decoded
+        gchar *tag = _window_file_get_tag(current->path);
+        reuse = tag && g_strcmp0(tag, prefetch->tag) == 0;
+        g_free(tag);
+    }
+
+    if (reuse)
+    {
+        pixbuf = g_object_ref(prefetch->anim);
+
+        if (prefetch->scaled)
+        {
+            uni_image_view_set_prerender(
+                        UNI_IMAGE_VIEW(window->view),
+                        gdk_pixbuf_animation_get_static_image(pixbuf),
+                        prefetch->scaled,
+                        prefetch->zoom,
+                        prefetch->interp);
+        }
+    }
+    else
+    {
+        pixbuf = gdk_pixbuf_animation_new_from_file(current->path, &error);
+    }
+
+    _window_prefetch_cancel(window);
 
     if (error != NULL)
     {
@@ -1463,6 +1612,9 @@ gboolean window_load_file(VnrWindow *window)
     gboolean ret = window_load_pixbuf(window, pixbuf, false);
     g_object_unref(pixbuf);
 
+    if (ret)
+        _window_prefetch_start(window);
+
     return ret;
 }
 
@@ -1500,6 +1652,7 @@ gboolean window_load_pixbuf(VnrWindow *window,
     window->current_image_height = gdk_pixbuf_animation_get_height(pixbuf);
 
     window->modified = modified;
+    _window_edits_clear(window);
 
     UniFittingMode last_fit_mode = UNI_IMAGE_VIEW(window->view)->fitting;
 
@@ -1561,6 +1714,7 @@ void window_close_file(VnrWindow *window)
 
     gtk_window_set_title(GTK_WINDOW(window), "ImgView");
     uni_anim_view_set_anim(UNI_ANIM_VIEW(window->view), NULL);
+    _window_edits_clear(window);
 
     //gtk_action_group_set_sensitive(window->actions_static_image, FALSE);
     _window_update_openwith_menu(window);
@@ -1715,6 +1869,7 @@ gboolean window_prev(VnrWindow *window)
     if (!prev)
         prev = g_list_last(window->filelist);
 
+    window->pf_backward = TRUE;
     _window_open_item(window, prev);
 
     if (window->mode == WINDOW_MODE_SLIDESHOW)
@@ -1759,6 +1914,7 @@ gboolean window_next(VnrWindow *window, gboolean reset_timer)
     if (!next)
         next = g_list_first(window->filelist);
 
+    window->pf_backward = FALSE;
     _window_open_item(window, next);
 
     if (reset_timer && window->mode == WINDOW_MODE_SLIDESHOW)
@@ -1787,6 +1943,205 @@ static gboolean _window_on_sl_timeout(VnrWindow *window)
     return G_SOURCE_REMOVE;
 }
 
+
+// prefetch -------------------------------------------------------------------
+
+static UniFittingMode _window_get_fitting(VnrWindow *window)
+{
+    // the fitting window_load_pixbuf will apply to the next image
+
+    if (window->mode != WINDOW_MODE_NORMAL && window->prefs->fit_on_fullscreen)
+        return UNI_FITTING_FULL;
+
+    switch (window->prefs->zoom)
+    {
+    case VNR_PREFS_ZOOM_SMART:
+        return UNI_FITTING_NORMAL;
+
+    case VNR_PREFS_ZOOM_FIT:
+        return UNI_FITTING_FULL;
+
+    case VNR_PREFS_ZOOM_LAST_USED:
+        return UNI_IMAGE_VIEW(window->view)->fitting;
+
+    default:
+        return UNI_FITTING_NONE;
+    }
+}
+
+static void _window_prefetch_start(VnrWindow *window)
+{
+    // decodes the image the user is likely to open next in a worker
+    // thread, then renders it at the size it will be displayed.
+
+    _window_prefetch_cancel(window);
+
+    if (g_list_length(g_list_first(window->filelist)) < 2)
+        return;
+
+    GList *item;
+
+    if (window->pf_backward)
+    {
+        item = g_list_previous(window->filelist);
+        if (!item)
+            item = g_list_last(window->filelist);
+    }
+    else
+    {
+        item = g_list_next(window->filelist);
+        if (!item)
+            item = g_list_first(window->filelist);
+    }
+
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(window->scroll_view, &allocation);
+
+    WindowPrefetch *prefetch = g_new0(WindowPrefetch, 1);
+    prefetch->path = g_strdup(VNR_FILE(item->data)->path);
+    prefetch->width = allocation.width;
+    prefetch->height = allocation.height;
+    prefetch->fitting = _window_get_fitting(window);
+    prefetch->interp = UNI_IMAGE_VIEW(window->view)->interp;
+
+    window->pf_cancellable = g_cancellable_new();
+
+    GTask *task = g_task_new(window, window->pf_cancellable,
+                             _window_prefetch_ready, NULL);
+    g_task_set_task_data(task, prefetch, NULL);
+    g_task_run_in_thread(task, _window_prefetch_thread);
+    g_object_unref(task);
+}
+
+static void _window_prefetch_cancel(VnrWindow *window)
+{
+    if (window->pf_cancellable)
+    {
+        g_cancellable_cancel(window->pf_cancellable);
+        g_object_unref(window->pf_cancellable);
+        window->pf_cancellable = NULL;
+    }
+
+    _window_prefetch_free(window->prefetch);
+    window->prefetch = NULL;
+}
+
+static void _window_prefetch_thread(GTask *task, gpointer source_object,
+                                    gpointer task_data,
+                                    GCancellable *cancellable)
+{
+    (void) source_object;
+
+    WindowPrefetch *prefetch = task_data;
+
+    // taken before decoding, a later change of the file invalidates it
+    prefetch->tag = _window_file_get_tag(prefetch->path);
+
+    prefetch->anim = gdk_pixbuf_animation_new_from_file(prefetch->path,
+                                                        NULL);
+
+    if (!prefetch->anim || g_cancellable_is_cancelled(cancellable))
+    {
+        g_task_return_pointer(task, prefetch,
+                              (GDestroyNotify) _window_prefetch_free);
+        return;
+    }
+
+    vnr_tools_apply_embedded_orientation(&prefetch->anim);
+
+    // make sure window_load_pixbuf won't apply it a second time
+    if (gdk_pixbuf_animation_is_static_image(prefetch->anim))
+    {
+        gdk_pixbuf_remove_option(
+                    gdk_pixbuf_animation_get_static_image(prefetch->anim),
+                    "orientation");
+    }
+
+    if (prefetch->fitting == UNI_FITTING_NONE
+        || prefetch->width < 1
+        || prefetch->height < 1
+        || !gdk_pixbuf_animation_is_static_image(prefetch->anim))
+    {
+        g_task_return_pointer(task, prefetch,
+                              (GDestroyNotify) _window_prefetch_free);
+        return;
+    }
+
+    GdkPixbuf *src = gdk_pixbuf_animation_get_static_image(prefetch->anim);
+    int src_width = gdk_pixbuf_get_width(src);
+    int src_height = gdk_pixbuf_get_height(src);
+
+    prefetch->zoom = uni_image_view_get_fit_zoom(prefetch->fitting,
+                                                 prefetch->width,
+                                                 prefetch->height,
+                                                 src_width,
+                                                 src_height);
+
+    // same rounding as the view's zoomed size
+    int width = (int) (src_width * prefetch->zoom + 0.5);
+    int height = (int) (src_height * prefetch->zoom + 0.5);
+
+    if (width > 0 && height > 0)
+    {
+        prefetch->scaled = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+                                          gdk_pixbuf_get_has_alpha(src),
+                                          8, width, height);
+    }
+
+    if (prefetch->scaled)
+    {
+        uni_pixbuf_scale_blend(src, prefetch->scaled,
+                               0, 0, width, height,
+                               0, 0,
+                               prefetch->zoom, prefetch->interp, 0, 0);
+    }
+
+    g_task_return_pointer(task, prefetch,
+                          (GDestroyNotify) _window_prefetch_free);
+}
+
+static gchar* _window_file_get_tag(const gchar *path)
+{
+    GStatBuf st;
+
+    if (g_stat(path, &st) != 0)
+        return NULL;
+
+    // a rename changes the inode, a rewrite in place the time or the size
+    return g_strdup_printf("%lu:%lu:%ld:%ld",
+                           (gulong) st.st_dev, (gulong) st.st_ino,
+                           (glong) st.st_mtime, (glong) st.st_size);
+}
+
+static void _window_prefetch_ready(GObject *source_object,
+                                   GAsyncResult *result,
+                                   gpointer user_data)
+{
+    (void) user_data;
+
+    VnrWindow *window = VNR_WINDOW(source_object);
+    GCancellable *cancellable = g_task_get_cancellable(G_TASK(result));
+
+    WindowPrefetch *prefetch = g_task_propagate_pointer(G_TASK(result),
+                                                        NULL);
+
+    if (!prefetch)
+        return;
+
+    if (cancellable != window->pf_cancellable
+        || g_cancellable_is_cancelled(cancellable)
+        || !prefetch->anim)
+    {
+        _window_prefetch_free(prefetch);
+        return;
+    }
+
+    g_clear_object(&window->pf_cancellable);
+
+    _window_prefetch_free(window->prefetch);
+    window->prefetch = prefetch;
+}
+
 gboolean window_first(VnrWindow *window)
 {
     GList *first = g_list_first(window->filelist);
@@ -2287,33 +2642,27 @@ static void _window_action_preferences(VnrWindow *window, GtkWidget *widget)
 
 // pixbuf ---------------------------------------------------------------------
 
+static gboolean _window_can_edit(VnrWindow *window)
+{
+    // the edits are frozen until the save in progress is done
+    return window->can_edit && window->save == NULL;
+}
+
 static void _window_rotate_pixbuf(VnrWindow *window,
                                   GdkPixbufRotation angle)
 {
+    if (!_window_can_edit(window))
+        return;
+
     if (!window->cursor_is_hidden)
         vnr_tools_set_cursor(GTK_WIDGET(window), GDK_WATCH, true);
 
     _window_slideshow_stop(window);
 
-    GdkPixbuf *result = gdk_pixbuf_rotate_simple(
-                            UNI_IMAGE_VIEW(window->view)->pixbuf,
-                            angle);
+    VnrEdit edit = {.type = VNR_EDIT_ROTATE, .angle = angle};
 
-    if (result == NULL)
-    {
-        vnr_message_area_show(VNR_MESSAGE_AREA(window->msg_area),
-                              TRUE, _("Not enough virtual memory."),
-                              FALSE);
+    if (!_window_edits_push(window, &edit))
         goto out;
-    }
-
-    _window_view_set_static(window, result);
-
-    if (gtk_widget_get_visible(window->props_dlg))
-    {
-        vnr_propsdlg_update_image(
-                                VNR_PROPERTIES_DIALOG(window->props_dlg));
-    }
 
 out:
 
@@ -2323,31 +2672,16 @@ out:
 
 static void _window_flip_pixbuf(VnrWindow *window, gboolean horizontal)
 {
-    if (!window->can_edit)
+    if (!_window_can_edit(window))
         return;
 
     if (!window->cursor_is_hidden)
         vnr_tools_set_cursor(GTK_WIDGET(window), GDK_WATCH, true);
 
-    GdkPixbuf *result = gdk_pixbuf_flip(
-                                UNI_IMAGE_VIEW(window->view)->pixbuf,
-                                horizontal);
+    VnrEdit edit = {.type = VNR_EDIT_FLIP, .horizontal = horizontal};
 
-    if (result == NULL)
-    {
-        vnr_message_area_show(VNR_MESSAGE_AREA(window->msg_area),
-                              TRUE, _("Not enough virtual memory."),
-                              FALSE);
+    if (!_window_edits_push(window, &edit))
         goto out;
-    }
-
-    _window_view_set_static(window, result);
-
-    if (gtk_widget_get_visible(window->props_dlg))
-    {
-        vnr_propsdlg_update_image(
-                            VNR_PROPERTIES_DIALOG(window->props_dlg));
-    }
 
  out:
 
@@ -2359,7 +2693,7 @@ static void _window_action_crop(VnrWindow *window, GtkWidget *widget)
 {
     (void) widget;
 
-    if (!window->can_edit)
+    if (!_window_can_edit(window))
         return;
 
     VnrCrop *crop = (VnrCrop*) vnr_crop_new(window);
@@ -2370,22 +2704,9 @@ static void _window_action_crop(VnrWindow *window, GtkWidget *widget)
         return;
     }
 
-    GdkPixbuf *original = uni_image_view_get_pixbuf(
-                            UNI_IMAGE_VIEW(window->view));
+    VnrEdit edit = {.type = VNR_EDIT_CROP, .area = crop->area};
 
-    GdkPixbuf *cropped = gdk_pixbuf_new(
-                            gdk_pixbuf_get_colorspace(original),
-                            gdk_pixbuf_get_has_alpha(original),
-                            gdk_pixbuf_get_bits_per_sample(original),
-                            crop->area.width,
-                            crop->area.height);
-
-    gdk_pixbuf_copy_area((const GdkPixbuf*) original,
-                         crop->area.x, crop->area.y,
-                         crop->area.width, crop->area.height,
-                         cropped, 0, 0);
-
-    _window_view_set_static(window, cropped);
+    _window_edits_push(window, &edit);
 
     g_object_unref(crop);
 }
@@ -2394,7 +2715,7 @@ static void _window_action_resize(VnrWindow *window, GtkWidget *widget)
 {
     (void) widget;
 
-    if (!window->can_edit)
+    if (!_window_can_edit(window))
         return;
 
     VnrResize *resize = (VnrResize*) vnr_resize_new(window);
@@ -2406,137 +2727,144 @@ static void _window_action_resize(VnrWindow *window, GtkWidget *widget)
         return;
     }
 
-    GdkPixbuf *inpix = uni_image_view_get_pixbuf(
-                            UNI_IMAGE_VIEW(window->view));
-    gdImage *imgin = gd_img_new_from_pixbuf(inpix);
+    VnrEdit edit = {.type = VNR_EDIT_RESIZE};
+    edit.size.width = resize->new_width;
+    edit.size.height = resize->new_height;
+    edit.size.flags = resize->linear_light ? GD_SCALE_LINEAR_LIGHT
+                                           : GD_SCALE_DEFAULT;
 
-    if (!imgin)
-        return;
+    _window_edits_push(window, &edit);
 
-    gd_img_set_interpolation_method(imgin, GD_LANCZOS3);
-    gdImage* imgout = gd_img_scale(imgin,
-                                   resize->new_width,
-                                   resize->new_height);
-    gd_img_free(imgin);
-    if (!imgout)
-    {
-        fprintf(stderr, "gdImageScale fails\n");
-        return;
-    }
+    g_object_unref(resize);
+}
 
-    GdkPixbuf *pixbuf = gd_to_pixbuf(imgout);
-    gd_img_free(imgout);
+static void _window_filter_grayscale(VnrWindow *window, GtkWidget *widget)
+{
+    (void) widget;
 
-    _window_view_set_static(window, pixbuf);
+    gdColorMatrix mat;
+    gd_color_matrix_saturation(&mat, 0);
 
-    g_object_unref(resize);
+    _window_filter_color(window, &mat);
 }
 
-static void _window_filter_grayscale(VnrWindow *window, GtkWidget *widget)
+static void _window_filter_sepia(VnrWindow *window, GtkWidget *widget)
 {
     (void) widget;
 
-    if (!window->can_edit)
+    gdColorMatrix mat;
+    gd_color_matrix_sepia(&mat);
+
+    _window_filter_color(window, &mat);
+}
+
+static void _window_filter_color(VnrWindow *window,
+                                 const gdColorMatrix *mat)
+{
+    if (!_window_can_edit(window))
         return;
 
-    GdkPixbuf *src_pixbuf = uni_image_view_get_pixbuf(
-                                        UNI_IMAGE_VIEW(window->view));
+    VnrEdit edit = {.type = VNR_EDIT_COLOR, .matrix = *mat};
 
-    GdkPixbuf *dest_pixbuf = _window_pixbuf_new(window);
+    _window_edits_push(window, &edit);
+}
 
-    const float mat[4][4] =
+static gboolean _window_edits_push(VnrWindow *window, const VnrEdit *edit)
+{
+    // the edits are rendered from the loaded image, not the last result
+    if (!window->edits)
     {
-        {0.3086, 0.3086, 0.3086, 0.0},
-        {0.6094, 0.6094, 0.6094, 0.0},
-        {0.0820, 0.0820, 0.0820, 0.0},
-        {0.0,    0.0,    0.0,    1.0},
-    };
+        GdkPixbuf *source = uni_image_view_get_pixbuf(
+                                            UNI_IMAGE_VIEW(window->view));
+        if (!source)
+            return false;
 
-    gint64 t1 = g_get_monotonic_time();
+        window->edits = vnr_edits_new(source);
 
-    _filter_transform(src_pixbuf, dest_pixbuf, mat);
+        vnr_edits_set_cache_limit(window->edits,
+                                  _window_get_undo_memory(window));
+    }
 
-    gint64 t2 = g_get_monotonic_time();
-    gint64 diff = t2 - t1;
-    printf("time = %d\n", (int) diff);
+    vnr_edits_push(window->edits, edit);
+
+    // the redo list is only dropped once the new edit is shown
+    if (!_window_edits_show(window))
+    {
+        vnr_edits_cancel(window->edits);
+        return false;
+    }
 
-    _window_view_set_static(window, dest_pixbuf);
+    return true;
 }
 
-static void _window_filter_sepia(VnrWindow *window, GtkWidget *widget)
+static gboolean _window_edits_show(VnrWindow *window)
 {
-    (void) widget;
+    // the view fits the previews in the scroll window
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(window->scroll_view, &allocation);
 
-    if (!window->can_edit)
-        return;
-
-    GdkPixbuf *src_pixbuf = uni_image_view_get_pixbuf(
-                                        UNI_IMAGE_VIEW(window->view));
+    vnr_edits_set_preview_size(window->edits,
+                               allocation.width, allocation.height);
 
-    GdkPixbuf *dest_pixbuf = _window_pixbuf_new(window);
+    GdkPixbuf *preview = vnr_edits_render(window->edits, TRUE);
 
-    const float mat[4][4] =
+    if (preview == NULL)
     {
-        {0.393, 0.349, 0.272, 0.0},
-        {0.769, 0.686, 0.534, 0.0},
-        {0.189, 0.168, 0.131, 0.0},
-        {0.0,   0.0,   0.0,   1.0},
-    };
+        vnr_message_area_show(VNR_MESSAGE_AREA(window->msg_area),
+                              TRUE, _("Not enough virtual memory."),
+                              FALSE);
+        return false;
+    }
 
-    gint64 t1 = g_get_monotonic_time();
+    _window_view_set_static(window, preview);
 
-    _filter_transform(src_pixbuf, dest_pixbuf, mat);
+    window->modified = vnr_edits_is_modified(window->edits);
+    _view_on_zoom_changed(UNI_IMAGE_VIEW(window->view), window);
 
-    gint64 t2 = g_get_monotonic_time();
-    gint64 diff = t2 - t1;
-    printf("time = %d\n", (int) diff);
+    if (gtk_widget_get_visible(window->props_dlg))
+    {
+        vnr_propsdlg_update_image(
+                            VNR_PROPERTIES_DIALOG(window->props_dlg));
+    }
 
-    _window_view_set_static(window, dest_pixbuf);
+    return true;
 }
 
-static void _filter_transform(GdkPixbuf *src_pixbuf, GdkPixbuf *dest_pixbuf,
-                              const float mat[4][4])
+static void _window_action_undo(VnrWindow *window, GtkWidget *widget)
 {
-    int height = gdk_pixbuf_get_height(dest_pixbuf);
-    int stride = gdk_pixbuf_get_rowstride(dest_pixbuf);
-    int max_h = height * stride;
-
-    int width = gdk_pixbuf_get_width(dest_pixbuf);
-    int channels = gdk_pixbuf_get_n_channels(dest_pixbuf);
-    int max_w = width * channels;
+    (void) widget;
 
-    assert(stride == gdk_pixbuf_get_rowstride(src_pixbuf));
-    assert(channels == gdk_pixbuf_get_n_channels(src_pixbuf));
+    if (!_window_can_edit(window) || !window->edits
+        || !vnr_edits_undo(window->edits))
+    {
+        return;
+    }
 
-    gboolean has_alpha = gdk_pixbuf_get_has_alpha(dest_pixbuf);
+    if (!_window_edits_show(window))
+        vnr_edits_redo(window->edits);
+}
 
-    guchar *src = gdk_pixbuf_get_pixels(src_pixbuf);
-    guchar *dest = gdk_pixbuf_get_pixels(dest_pixbuf);
+static void _window_action_redo(VnrWindow *window, GtkWidget *widget)
+{
+    (void) widget;
 
-    for (int y = 0; y < max_h; y+=stride)
+    if (!_window_can_edit(window) || !window->edits
+        || !vnr_edits_redo(window->edits))
     {
-        for (int x = 0; x < max_w; x+=channels)
-        {
-            int offset = y + x;
-
-            guchar *src_color = src + offset;
-            guchar *dest_color = dest + offset;
+        return;
+    }
 
-            float level;
+    if (!_window_edits_show(window))
+        vnr_edits_undo(window->edits);
+}
 
-            for (int i = 0; i < 3; ++i)
-            {
-                level =   mat[0][i] * src_color[0]
-                        + mat[1][i] * src_color[1]
-                        + mat[2][i] * src_color[2]
-                        + mat[3][i];
-                dest_color[i] = (uint8_t) CLAMP(level, 0, 255);
-            }
+static void _window_edits_clear(VnrWindow *window)
+{
+    vnr_edits_free(window->edits);
+    window->edits = NULL;
 
-            if (has_alpha)
-                dest_color[3] = src_color[3];
-        }
-    }
+    // a save in progress no longer concerns the image displayed
+    window->save = NULL;
 }
 
 static void _window_view_set_static(VnrWindow *window, GdkPixbuf *pixbuf)
@@ -2548,8 +2876,19 @@ static void _window_view_set_static(VnrWindow *window, GdkPixbuf *pixbuf)
     g_object_unref(pixbuf);
 
     window->modified = true;
-    window->current_image_width = gdk_pixbuf_get_width(pixbuf);
-    window->current_image_height = gdk_pixbuf_get_height(pixbuf);
+
+    // the previews may be smaller than the result
+    if (window->edits)
+    {
+        vnr_edits_get_size(window->edits,
+                           &window->current_image_width,
+                           &window->current_image_height);
+    }
+    else
+    {
+        window->current_image_width = gdk_pixbuf_get_width(pixbuf);
+        window->current_image_height = gdk_pixbuf_get_height(pixbuf);
+    }
 
     //gtk_action_group_set_sensitive(window->action_save, TRUE);
 
@@ -2567,75 +2906,417 @@ static void _window_view_set_static(VnrWindow *window, GdkPixbuf *pixbuf)
 
 // ----------------------------------------------------------------------------
 
-static void _window_action_save_image(VnrWindow *window, GtkWidget *widget)
+// The image is saved in a worker thread : it's encoded in memory and
+// written once in a temporary file of the same directory, which is synced
+// then renamed over the original, so that a crash never leaves a truncated
+// image behind.
+typedef struct _WindowSave
 {
-    (void) widget;
+    gchar *path;
+    gchar *format;
+    gint jpeg_quality;
+    gint png_compression;
+    gboolean png_parallel;
 
-    VnrFile *current = window_get_current_file(window);
-    if (!current)
+    // a copy of the edits, rendered by the worker, or the image to save
+    VnrEdits *edits;
+    GdkPixbuf *pixbuf;
+
+    // identity of the file written, to recognize its monitor events
+    gchar *tag;
+    gboolean done;
+
+} WindowSave;
+
+typedef struct _WindowSaveProgress
+{
+    GTask *task;
+    gchar *message;
+
+} WindowSaveProgress;
+
+static void _window_save_free(WindowSave *save)
+{
+    if (!save)
         return;
 
-    if (!window->cursor_is_hidden)
-        vnr_tools_set_cursor(GTK_WIDGET(window), GDK_WATCH, true);
+    g_free(save->path);
+    g_free(save->format);
+    vnr_edits_free(save->edits);
 
-    // Store exiv2 metadata to cache, so we can restore it afterwards
-    uni_read_exiv2_to_cache(current->path);
+    if (save->pixbuf)
+        g_object_unref(save->pixbuf);
 
-    GError *error = NULL;
+    g_free(save->tag);
+    g_free(save);
+}
+
+static gboolean _window_save_on_progress(WindowSaveProgress *progress)
+{
+    VnrWindow *window = VNR_WINDOW(g_task_get_source_object(progress->task));
+    WindowSave *save = g_task_get_task_data(progress->task);
+
+    // the result may have been dispatched before this idle
+    if (!save->done && window->save == save)
+    {
+        vnr_message_area_show(VNR_MESSAGE_AREA(window->msg_area), FALSE,
+                              progress->message, FALSE);
+    }
+
+    g_object_unref(progress->task);
+    g_free(progress->message);
+    g_free(progress);
 
-    if (g_strcmp0(window->writable_format_name, "jpeg") == 0)
+    return G_SOURCE_REMOVE;
+}
+
+static void _window_save_progress(GTask *task, const gchar *stage)
+{
+    WindowSave *save = g_task_get_task_data(task);
+
+    gchar *name = g_path_get_basename(save->path);
+
+    WindowSaveProgress *progress = g_new0(WindowSaveProgress, 1);
+    progress->task = g_object_ref(task);
+    progress->message = g_strdup_printf(_("Saving %s: %s..."), name, stage);
+
+    g_free(name);
+
+    g_idle_add((GSourceFunc) _window_save_on_progress, progress);
+}
+
+static gboolean _window_save_encode(WindowSave *save, GdkPixbuf *pixbuf,
+                                    gchar **buffer, gsize *size,
+                                    GError **error)
+{
+    gboolean saved;
+
+    if (g_strcmp0(save->format, "jpeg") == 0)
     {
-        gchar *quality = g_strdup_printf("%i", window->prefs->jpeg_quality);
+        gchar *quality = g_strdup_printf("%i", save->jpeg_quality);
 
-        gdk_pixbuf_save(
-                uni_image_view_get_pixbuf(UNI_IMAGE_VIEW(window->view)),
-                current->path, "jpeg",
-                &error, "quality", quality, NULL);
+        saved = gdk_pixbuf_save_to_buffer(
+                    pixbuf, buffer, size, "jpeg",
+                    error, "quality", quality, NULL);
 
         g_free(quality);
     }
-    else if (g_strcmp0(window->writable_format_name, "png") == 0)
+    else if (g_strcmp0(save->format, "png") == 0)
     {
+        // deflated on all the cores, unless the layout isn't supported
+        if (save->png_parallel)
+        {
+            saved = vnr_png_save_to_buffer(pixbuf, save->png_compression,
+                                           buffer, size, error);
+            if (saved || *error)
+                return saved;
+        }
+
         gchar *compression;
-        compression = g_strdup_printf("%i", window->prefs->png_compression);
+        compression = g_strdup_printf("%i", save->png_compression);
 
-        gdk_pixbuf_save(
-                uni_image_view_get_pixbuf(UNI_IMAGE_VIEW(window->view)),
-                current->path, "png",
-                &error, "compression", compression, NULL);
+        saved = gdk_pixbuf_save_to_buffer(
+                    pixbuf, buffer, size, "png",
+                    error, "compression", compression, NULL);
 
         g_free(compression);
     }
     else
     {
-        gdk_pixbuf_save(
-                uni_image_view_get_pixbuf(UNI_IMAGE_VIEW(window->view)),
-                current->path,
-                window->writable_format_name, &error, NULL);
+        saved = gdk_pixbuf_save_to_buffer(pixbuf, buffer, size,
+                                          save->format, error, NULL);
     }
 
-    uni_write_exiv2_from_cache(current->path);
+    return saved;
+}
 
-    if (!window->cursor_is_hidden)
-        vnr_tools_set_cursor(GTK_WIDGET(window), GDK_LEFT_PTR, false);
+static gboolean _window_save_fd(int fd, const gchar *path,
+                                const gchar *buffer, gsize size,
+                                mode_t mode, GError **error)
+{
+    gboolean ret = true;
 
-    if (error != NULL)
+    while (ret && size > 0)
+    {
+        gssize written = write(fd, buffer, size);
+
+        if (written < 0)
+        {
+            ret = (errno == EINTR);
+            continue;
+        }
+
+        buffer += written;
+        size -= written;
+    }
+
+    // keep the permissions of the original
+    if (ret)
+        ret = (fchmod(fd, mode) == 0 && fsync(fd) == 0);
+
+    if (!ret)
+    {
+        int errsv = errno;
+
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    _("Could not write %s: %s"), path, g_strerror(errsv));
+    }
+
+    return ret;
+}
+
+static gboolean _window_save_write(GTask *task, WindowSave *save,
+                                   GError **error)
+{
+    gchar *buffer = NULL;
+    gsize size = 0;
+
+    // rotations, flips and aligned crops of a JPEG file are done on the
+    // compressed data, without a loss and with the metadata kept
+    if (save->edits && g_strcmp0(save->format, "jpeg") == 0)
+    {
+        _window_save_progress(task, _("transforming"));
+
+        if (!vnr_jpeg_transform(save->path, save->edits,
+                                &buffer, &size, error) && *error)
+            return false;
+    }
+
+    if (!buffer)
+    {
+        // the edits are rendered again from the loaded image, at full
+        // quality
+        GdkPixbuf *pixbuf;
+
+        if (save->edits)
+        {
+            _window_save_progress(task, _("rendering the edits"));
+            pixbuf = vnr_edits_render(save->edits, FALSE);
+        }
+        else
+        {
+            pixbuf = g_object_ref(save->pixbuf);
+        }
+
+        if (!pixbuf)
+        {
+            g_set_error_literal(error, GDK_PIXBUF_ERROR,
+                                GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                                _("Not enough virtual memory."));
+            return false;
+        }
+
+        // encoded in memory, the metadata merged in the buffer, so that
+        // the file is written once
+        _window_save_progress(task, _("encoding"));
+
+        gboolean encoded = _window_save_encode(save, pixbuf,
+                                               &buffer, &size, error);
+        g_object_unref(pixbuf);
+
+        if (!encoded)
+            return false;
+
+        _window_save_progress(task, _("copying the metadata"));
+
+        uni_copy_exiv2_to_buffer(save->path, &buffer, &size);
+    }
+
+    // the file a link names is replaced, not the link
+    char *real = realpath(save->path, NULL);
+    gchar *path = g_strdup(real ? real : save->path);
+    free(real);
+
+    GStatBuf st;
+    mode_t mode = 0644;
+    gboolean in_place = false;
+
+    if (g_stat(path, &st) == 0)
+    {
+        mode = st.st_mode & 07777;
+
+        // a rename would leave the old image to the other hard links
+        in_place = (st.st_nlink > 1);
+    }
+
+    gchar *dirname = g_path_get_dirname(path);
+    gchar *temp = NULL;
+    gboolean saved = false;
+    int fd;
+
+    if (in_place)
+    {
+        _window_save_progress(task, _("writing"));
+
+        fd = g_open(path, O_WRONLY | O_TRUNC, 0);
+
+        if (fd < 0)
+        {
+            int errsv = errno;
+
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                        _("Could not write %s: %s"),
+                        path, g_strerror(errsv));
+            goto out;
+        }
+
+        saved = _window_save_fd(fd, path, buffer, size, mode, error);
+
+        close(fd);
+
+        if (saved)
+            save->tag = _window_file_get_tag(path);
+
+        goto out;
+    }
+
+    gchar *basename = g_path_get_basename(path);
+    temp = g_strdup_printf("%s/.%s.XXXXXX", dirname, basename);
+    g_free(basename);
+
+    fd = g_mkstemp(temp);
+
+    if (fd < 0)
+    {
+        int errsv = errno;
+
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    _("Could not create a temporary file in %s: %s"),
+                    dirname, g_strerror(errsv));
+        goto out;
+    }
+
+    _window_save_progress(task, _("writing"));
+
+    saved = _window_save_fd(fd, temp, buffer, size, mode, error);
+
+    close(fd);
+
+    if (saved && g_rename(temp, path) != 0)
+    {
+        int errsv = errno;
+
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    _("Could not replace %s: %s"),
+                    path, g_strerror(errsv));
+        saved = false;
+    }
+
+    if (!saved)
+    {
+        g_unlink(temp);
+        goto out;
+    }
+
+    // make the rename durable
+    fd = g_open(dirname, O_RDONLY, 0);
+
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+
+    save->tag = _window_file_get_tag(path);
+
+out:
+    g_free(temp);
+    g_free(dirname);
+    g_free(path);
+    g_free(buffer);
+
+    return saved;
+}
+
+static void _window_save_thread(GTask *task, gpointer source_object,
+                                gpointer task_data,
+                                GCancellable *cancellable)
+{
+    (void) source_object;
+    (void) cancellable;
+
+    GError *error = NULL;
+
+    if (_window_save_write(task, task_data, &error))
+        g_task_return_boolean(task, TRUE);
+    else
+        g_task_return_error(task, error);
+}
+
+static void _window_save_ready(GObject *source_object,
+                               GAsyncResult *result,
+                               gpointer user_data)
+{
+    (void) user_data;
+
+    VnrWindow *window = VNR_WINDOW(source_object);
+    WindowSave *save = g_task_get_task_data(G_TASK(result));
+
+    GError *error = NULL;
+    gboolean saved = g_task_propagate_boolean(G_TASK(result), &error);
+
+    // the edits saved are still the ones displayed
+    gboolean current = (window->save == save);
+
+    save->done = true;
+    --window->saving;
+
+    if (current)
+        window->save = NULL;
+
+    if (window->quit_on_saved)
+    {
+        if (!saved)
+        {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+        }
+
+        if (window->saving == 0)
+            gtk_main_quit();
+
+        return;
+    }
+
+    if (!saved)
     {
         vnr_message_area_show(VNR_MESSAGE_AREA(window->msg_area), TRUE,
                               error->message, FALSE);
+        g_error_free(error);
+
         return;
     }
 
-    if (!window->prefs->reload_on_save)
+    // the monitor won't reload the file written
+    g_free(window->saved_tag);
+    window->saved_tag = g_strdup(save->tag);
+
+    if (!current)
+        return;
+
+    if (gtk_widget_get_visible(window->msg_area)
+        && !vnr_message_area_is_critical(VNR_MESSAGE_AREA(window->msg_area)))
     {
-        window->no_reload = true;
+        vnr_message_area_hide(VNR_MESSAGE_AREA(window->msg_area));
+    }
 
-        //window_load_file(window, FALSE);
-        //return;
+    if (window->prefs->reload_on_save)
+    {
+        window_load_file(window);
+        return;
     }
 
     window->modified = false;
 
+    if (window->edits)
+    {
+        vnr_edits_set_saved(window->edits);
+
+        // the preview shares the pixels of the old source, show the new one
+        if (vnr_edits_compact(window->edits))
+            _window_edits_show(window);
+    }
+
     //gtk_action_group_set_sensitive(window->action_save, FALSE);
 
     _view_on_zoom_changed(UNI_IMAGE_VIEW(window->view), window);
@@ -2644,6 +3325,49 @@ static void _window_action_save_image(VnrWindow *window, GtkWidget *widget)
         vnr_propsdlg_update(VNR_PROPERTIES_DIALOG(window->props_dlg));
 }
 
+static void _window_action_save_image(VnrWindow *window, GtkWidget *widget)
+{
+    (void) widget;
+
+    VnrFile *current = window_get_current_file(window);
+    if (!current || window->save)
+        return;
+
+    WindowSave *save = g_new0(WindowSave, 1);
+    save->path = g_strdup(current->path);
+    save->format = g_strdup(window->writable_format_name);
+    save->jpeg_quality = window->prefs->jpeg_quality;
+    save->png_compression = window->prefs->png_compression;
+    save->png_parallel = window->prefs->png_parallel;
+
+    if (window->edits)
+    {
+        save->edits = vnr_edits_copy(window->edits);
+    }
+    else
+    {
+        save->pixbuf = g_object_ref(uni_image_view_get_pixbuf(
+                                            UNI_IMAGE_VIEW(window->view)));
+    }
+
+    window->save = save;
+    ++window->saving;
+
+    gchar *name = g_path_get_basename(save->path);
+    gchar *message = g_strdup_printf(_("Saving %s..."), name);
+
+    vnr_message_area_show(VNR_MESSAGE_AREA(window->msg_area), FALSE,
+                          message, FALSE);
+
+    g_free(message);
+    g_free(name);
+
+    GTask *task = g_task_new(window, NULL, _window_save_ready, NULL);
+    g_task_set_task_data(task, save, (GDestroyNotify) _window_save_free);
+    g_task_run_in_thread(task, _window_save_thread);
+    g_object_unref(task);
+}
+
 static void _window_action_zoom_normal(VnrWindow *window, GtkWidget *widget)
 {
     (void) widget;
@@ -58,12 +58,16 @@ struct _VnrWindow
     gint current_image_height;
     gboolean cursor_is_hidden;
     guint8 modified;
+    struct _VnrEdits *edits;
     gchar *writable_format_name;
+    struct _WindowSave *save;
+    guint saving;                   // saves running, with detached ones
+    gboolean quit_on_saved;
 
     // reload
     GFileMonitor *monitor;
     gboolean need_reload;
-    gboolean no_reload;
+    gchar *saved_tag;
 
     // widgets
     GtkWidget *layout_box;
@@ -86,6 +90,10 @@ struct _VnrWindow
     GtkWidget *sl_timeout_widget;
     guint sl_source_id;
     gint sl_timeout;
+    // neighbour prefetch
+    GCancellable *pf_cancellable;
+    struct _WindowPrefetch *prefetch;
+    gboolean pf_backward;
 };
 
 GType window_get_type() G_GNUC_CONST;